@@ -0,0 +1,184 @@
+#ifndef BOUNDS_H
+#define BOUNDS_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <utility>
+
+// axis aligned bounding box. A default constructed box is empty and grows with Expand.
+struct AABB {
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+
+    bool Empty() const
+    {
+        return min.x > max.x;
+    }
+
+    void Expand(const glm::vec3 &point)
+    {
+        min = glm::vec3(std::min(min.x, point.x), std::min(min.y, point.y), std::min(min.z, point.z));
+        max = glm::vec3(std::max(max.x, point.x), std::max(max.y, point.y), std::max(max.z, point.z));
+    }
+
+    void Expand(const AABB &box)
+    {
+        if (box.Empty())
+            return;
+        Expand(box.min);
+        Expand(box.max);
+    }
+
+    glm::vec3 Center() const
+    {
+        return (min + max) * 0.5f;
+    }
+
+    glm::vec3 Extents() const
+    {
+        return (max - min) * 0.5f;
+    }
+
+    float SurfaceArea() const
+    {
+        if (Empty())
+            return 0.0f;
+        glm::vec3 size = max - min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    float DistanceSquared(const glm::vec3 &point) const
+    {
+        float distance = 0.0f;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float outside = std::max(std::max(min[axis] - point[axis], point[axis] - max[axis]), 0.0f);
+            distance += outside * outside;
+        }
+        return distance;
+    }
+
+    // slab test. inverseDirection is 1 / ray direction per axis, hit is the entry distance
+    // (0 if the origin is inside). Misses and hits beyond maxDistance return false.
+    bool IntersectRay(const glm::vec3 &origin, const glm::vec3 &inverseDirection, float maxDistance, float &hit) const
+    {
+        float tMin = 0.0f, tMax = maxDistance;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float t0 = (min[axis] - origin[axis]) * inverseDirection[axis];
+            float t1 = (max[axis] - origin[axis]) * inverseDirection[axis];
+            if (t0 > t1)
+                std::swap(t0, t1);
+            tMin = std::max(tMin, t0);
+            tMax = std::min(tMax, t1);
+            if (tMin > tMax)
+                return false;
+        }
+        hit = tMin;
+        return true;
+    }
+
+    // box around this one after transform (Arvo: the extents go through the absolute rotation/scale)
+    AABB Transformed(const glm::mat4 &transform) const
+    {
+        if (Empty())
+            return *this;
+        glm::vec3 center = glm::vec3(transform * glm::vec4(Center(), 1.0f));
+        glm::vec3 extents = Extents();
+        glm::vec3 newExtents(0.0f);
+        for (int column = 0; column < 3; column++)
+            for (int row = 0; row < 3; row++)
+                newExtents[row] += std::fabs(transform[column][row]) * extents[column];
+        AABB box;
+        box.min = center - newExtents;
+        box.max = center + newExtents;
+        return box;
+    }
+};
+
+struct BoundingSphere {
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = 0.0f;
+};
+
+// the six planes of a view frustum, normals pointing inwards. Planes are (normal, distance)
+// with dot(normal, p) + distance >= 0 for points inside.
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // Gribb/Hartmann extraction from a projection * view matrix, gives world space planes
+    static Frustum FromMatrix(const glm::mat4 &viewProjection)
+    {
+        const glm::mat4 &m = viewProjection;
+        glm::vec4 row[4];
+        for (int i = 0; i < 4; i++)
+            row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+        Frustum frustum;
+        frustum.planes[0] = row[3] + row[0];  // left
+        frustum.planes[1] = row[3] - row[0];  // right
+        frustum.planes[2] = row[3] + row[1];  // bottom
+        frustum.planes[3] = row[3] - row[1];  // top
+        frustum.planes[4] = row[3] + row[2];  // near
+        frustum.planes[5] = row[3] - row[2];  // far
+        for (glm::vec4 &plane : frustum.planes)
+            plane = plane / glm::length(glm::vec3(plane));
+        return frustum;
+    }
+
+    enum Containment { Outside, Intersecting, Inside };
+
+    // Inside if the box is behind every plane, Outside if it is completely in front of one of them
+    Containment Classify(const AABB &box) const
+    {
+        if (box.Empty())
+            return Outside;
+        Containment result = Inside;
+        for (const glm::vec4 &plane : planes)
+        {
+            glm::vec3 normal(plane);
+            glm::vec3 positive(plane.x >= 0.0f ? box.max.x : box.min.x,
+                               plane.y >= 0.0f ? box.max.y : box.min.y,
+                               plane.z >= 0.0f ? box.max.z : box.min.z);
+            glm::vec3 negative(plane.x >= 0.0f ? box.min.x : box.max.x,
+                               plane.y >= 0.0f ? box.min.y : box.max.y,
+                               plane.z >= 0.0f ? box.min.z : box.max.z);
+            if (glm::dot(normal, positive) + plane.w < 0.0f)
+                return Outside;
+            if (glm::dot(normal, negative) + plane.w < 0.0f)
+                result = Intersecting;
+        }
+        return result;
+    }
+
+    // false only if the box is completely outside one of the planes, so a few boxes near the
+    // frustum corners are kept although they are not visible
+    bool Intersects(const AABB &box) const
+    {
+        if (box.Empty())
+            return false;
+        for (const glm::vec4 &plane : planes)
+        {
+            // the corner furthest along the plane normal
+            glm::vec3 positive(plane.x >= 0.0f ? box.max.x : box.min.x,
+                               plane.y >= 0.0f ? box.max.y : box.min.y,
+                               plane.z >= 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+                return false;
+        }
+        return true;
+    }
+
+    bool Intersects(const BoundingSphere &sphere) const
+    {
+        for (const glm::vec4 &plane : planes)
+            if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius)
+                return false;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,373 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/bounds.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <vector>
+
+// Bounding volume hierarchy over world space boxes of placed objects. Items are identified by
+// their index in the vector passed to Build, callers keep whatever they need per item in a
+// parallel array.
+//
+// Build splits with a binned surface area heuristic. When an object moves, Update refits the
+// boxes from its leaf up to the root without changing the tree; after many moves the tree gets
+// loose, RefitQuality tells how much and Build can simply be called again.
+//
+// Every node covers a contiguous range of the item order, so a node that is completely inside
+// the frustum hands out its whole range without looking at the children.
+class BVH
+{
+public:
+    // a leaf is only split further when it holds more items than this
+    static const unsigned int MaxLeafItems = 4;
+
+    struct Hit {
+        int item = -1;
+        float distance = FLT_MAX;
+    };
+
+    void Build(const vector<AABB> &bounds)
+    {
+        itemBounds = bounds;
+        order.resize(bounds.size());
+        itemLeaf.assign(bounds.size(), 0);
+        nodes.clear();
+        centroids.resize(bounds.size());
+        for (unsigned int i = 0; i < bounds.size(); i++)
+        {
+            order[i] = i;
+            centroids[i] = bounds[i].Center();
+        }
+        if (bounds.empty())
+            return;
+        nodes.reserve(2 * bounds.size() / MaxLeafItems + 1);
+        nodes.push_back(Node());
+        build(0, 0, (unsigned int)bounds.size(), -1, 0);
+        builtCost = Cost();
+    }
+
+    // moves item to new bounds and refits its ancestors
+    void Update(unsigned int item, const AABB &bounds)
+    {
+        itemBounds[item] = bounds;
+        int index = (int)itemLeaf[item];
+        Node &leaf = nodes[index];
+        leaf.bounds = AABB();
+        for (unsigned int i = leaf.first; i < leaf.first + leaf.count; i++)
+            leaf.bounds.Expand(itemBounds[order[i]]);
+        for (index = leaf.parent; index >= 0; index = nodes[index].parent)
+        {
+            Node &node = nodes[index];
+            node.bounds = nodes[node.left].bounds;
+            node.bounds.Expand(nodes[node.left + 1].bounds);
+        }
+    }
+
+    // appends the items whose boxes touch the frustum
+    void QueryFrustum(const Frustum &frustum, vector<unsigned int> &result) const
+    {
+        if (nodes.empty())
+            return;
+        unsigned int stack[64];
+        unsigned int depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0)
+        {
+            const Node &node = nodes[stack[--depth]];
+            Frustum::Containment containment = frustum.Classify(node.bounds);
+            if (containment == Frustum::Outside)
+                continue;
+            if (containment == Frustum::Inside)
+            {
+                result.insert(result.end(), order.begin() + node.first, order.begin() + node.first + node.count);
+                continue;
+            }
+            if (node.Leaf())
+            {
+                for (unsigned int i = node.first; i < node.first + node.count; i++)
+                    if (frustum.Intersects(itemBounds[order[i]]))
+                        result.push_back(order[i]);
+                continue;
+            }
+            stack[depth++] = node.left;
+            stack[depth++] = node.left + 1;
+        }
+    }
+
+    // closest item box hit by the ray, direction does not have to be normalized
+    // (the distance is then in multiples of its length)
+    Hit Raycast(const glm::vec3 &origin, const glm::vec3 &direction, float maxDistance = FLT_MAX) const
+    {
+        Hit hit;
+        hit.distance = maxDistance;
+        if (nodes.empty())
+            return hit;
+        glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        float entry;
+        if (!nodes[0].bounds.IntersectRay(origin, inverse, hit.distance, entry))
+            return hit;
+
+        unsigned int stack[64];
+        unsigned int depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0)
+        {
+            const Node &node = nodes[stack[--depth]];
+            if (node.Leaf())
+            {
+                for (unsigned int i = node.first; i < node.first + node.count; i++)
+                {
+                    float distance;
+                    if (itemBounds[order[i]].IntersectRay(origin, inverse, hit.distance, distance) && distance < hit.distance)
+                    {
+                        hit.item = (int)order[i];
+                        hit.distance = distance;
+                    }
+                }
+                continue;
+            }
+            // visit the nearer child first so the far one is usually pruned by the hit distance
+            float nearEntry, farEntry;
+            unsigned int nearChild = node.left, farChild = node.left + 1;
+            bool nearHit = nodes[nearChild].bounds.IntersectRay(origin, inverse, hit.distance, nearEntry);
+            bool farHit = nodes[farChild].bounds.IntersectRay(origin, inverse, hit.distance, farEntry);
+            if (nearHit && farHit && farEntry < nearEntry)
+            {
+                std::swap(nearChild, farChild);
+                std::swap(nearEntry, farEntry);
+            }
+            else if (!nearHit && farHit)
+            {
+                std::swap(nearChild, farChild);
+                std::swap(nearHit, farHit);
+            }
+            if (farHit)
+                stack[depth++] = farChild;
+            if (nearHit)
+                stack[depth++] = nearChild;
+        }
+        if (hit.item < 0)
+            hit.distance = FLT_MAX;
+        return hit;
+    }
+
+    // item whose box is closest to point (0 for boxes containing it), within maxDistance
+    Hit Nearest(const glm::vec3 &point, float maxDistance = FLT_MAX) const
+    {
+        Hit hit;
+        if (nodes.empty())
+            return hit;
+        float best = maxDistance == FLT_MAX ? FLT_MAX : maxDistance * maxDistance;
+
+        unsigned int stack[64];
+        unsigned int depth = 0;
+        stack[depth++] = 0;
+        while (depth > 0)
+        {
+            const Node &node = nodes[stack[--depth]];
+            if (node.bounds.DistanceSquared(point) >= best)
+                continue;
+            if (node.Leaf())
+            {
+                for (unsigned int i = node.first; i < node.first + node.count; i++)
+                {
+                    float distance = itemBounds[order[i]].DistanceSquared(point);
+                    if (distance < best)
+                    {
+                        best = distance;
+                        hit.item = (int)order[i];
+                    }
+                }
+                continue;
+            }
+            unsigned int nearChild = node.left, farChild = node.left + 1;
+            if (nodes[farChild].bounds.DistanceSquared(point) < nodes[nearChild].bounds.DistanceSquared(point))
+                std::swap(nearChild, farChild);
+            stack[depth++] = farChild;
+            stack[depth++] = nearChild;
+        }
+        if (hit.item >= 0)
+            hit.distance = std::sqrt(best);
+        return hit;
+    }
+
+    // SAH cost of the tree: expected number of node visits plus item tests for a random ray
+    float Cost() const
+    {
+        if (nodes.empty())
+            return 0.0f;
+        float rootArea = std::max(nodes[0].bounds.SurfaceArea(), FLT_MIN);
+        float cost = 0.0f;
+        for (const Node &node : nodes)
+            cost += node.bounds.SurfaceArea() / rootArea * (node.Leaf() ? (float)node.count : TraversalCost);
+        return cost;
+    }
+
+    // current cost relative to the one right after Build, above ~1.5 a rebuild pays off
+    float RefitQuality() const
+    {
+        return builtCost > 0.0f ? Cost() / builtCost : 1.0f;
+    }
+
+    unsigned int NodeCount() const
+    {
+        return (unsigned int)nodes.size();
+    }
+
+    unsigned int ItemCount() const
+    {
+        return (unsigned int)itemBounds.size();
+    }
+
+    const AABB &ItemBounds(unsigned int item) const
+    {
+        return itemBounds[item];
+    }
+
+private:
+    static const unsigned int Bins = 16;
+    // below this depth only median splits are made, the tree stays shallower than the 64 entry query stacks
+    static const unsigned int MaxSAHDepth = 32;
+    // cost of visiting an inner node, relative to testing one item
+    static constexpr float TraversalCost = 1.0f;
+
+    // children of an inner node are stored next to each other, left and left + 1
+    struct Node {
+        AABB bounds;
+        unsigned int first = 0;
+        unsigned int count = 0;
+        int left = -1;
+        int parent = -1;
+
+        bool Leaf() const
+        {
+            return left < 0;
+        }
+    };
+
+    vector<Node> nodes;
+    vector<AABB> itemBounds;
+    vector<glm::vec3> centroids;
+    vector<unsigned int> order;     // item indices, every node covers order[first, first + count)
+    vector<unsigned int> itemLeaf;
+    float builtCost = 0.0f;
+
+    void build(unsigned int index, unsigned int first, unsigned int count, int parent, unsigned int depth)
+    {
+        AABB bounds, centroidBounds;
+        for (unsigned int i = first; i < first + count; i++)
+        {
+            bounds.Expand(itemBounds[order[i]]);
+            centroidBounds.Expand(centroids[order[i]]);
+        }
+        nodes[index].bounds = bounds;
+        nodes[index].first = first;
+        nodes[index].count = count;
+        nodes[index].parent = parent;
+
+        if (count <= MaxLeafItems)
+        {
+            makeLeaf(index);
+            return;
+        }
+
+        // binned SAH: project the centroids into Bins slots along each axis and evaluate the
+        // Bins - 1 planes between them
+        int bestAxis = -1;
+        unsigned int bestSplit = 0;
+        float bestCost = (float)count * bounds.SurfaceArea();
+        glm::vec3 extent = centroidBounds.max - centroidBounds.min;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (extent[axis] <= 0.0f)
+                continue;
+            AABB binBounds[Bins];
+            unsigned int binCounts[Bins] = {};
+            float scale = Bins / extent[axis];
+            for (unsigned int i = first; i < first + count; i++)
+            {
+                unsigned int bin = binOf(centroids[order[i]][axis], centroidBounds.min[axis], scale);
+                binBounds[bin].Expand(itemBounds[order[i]]);
+                binCounts[bin]++;
+            }
+
+            // areas and counts left of each plane, swept from the left
+            float leftArea[Bins - 1];
+            unsigned int leftCount[Bins - 1];
+            AABB sweep;
+            unsigned int sweepCount = 0;
+            for (unsigned int plane = 0; plane < Bins - 1; plane++)
+            {
+                sweep.Expand(binBounds[plane]);
+                sweepCount += binCounts[plane];
+                leftArea[plane] = sweep.SurfaceArea();
+                leftCount[plane] = sweepCount;
+            }
+            sweep = AABB();
+            sweepCount = 0;
+            for (unsigned int plane = Bins - 1; plane > 0; plane--)
+            {
+                sweep.Expand(binBounds[plane]);
+                sweepCount += binCounts[plane];
+                if (leftCount[plane - 1] == 0 || sweepCount == 0)
+                    continue;
+                float cost = TraversalCost * bounds.SurfaceArea()
+                             + leftArea[plane - 1] * leftCount[plane - 1] + sweep.SurfaceArea() * sweepCount;
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = plane;
+                }
+            }
+        }
+
+        unsigned int middle;
+        if (bestAxis >= 0 && depth < MaxSAHDepth)
+        {
+            float minimum = centroidBounds.min[bestAxis];
+            float scale = Bins / extent[bestAxis];
+            auto split = std::partition(order.begin() + first, order.begin() + first + count, [&](unsigned int item) {
+                return binOf(centroids[item][bestAxis], minimum, scale) < bestSplit;
+            });
+            middle = (unsigned int)(split - order.begin());
+        }
+        else
+        {
+            // splitting does not pay off, but a leaf this big would make queries linear. Or the tree got
+            // deep on a skewed distribution. Halve along the longest axis (by position if all centroids
+            // coincide), which bounds the depth so the query stacks can have a fixed size.
+            int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+            middle = first + count / 2;
+            std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count,
+                             [&](unsigned int a, unsigned int b) { return centroids[a][axis] < centroids[b][axis]; });
+        }
+
+        int left = (int)nodes.size();
+        nodes[index].left = left;
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        build(left, first, middle - first, (int)index, depth + 1);
+        build(left + 1, middle, first + count - middle, (int)index, depth + 1);
+    }
+
+    void makeLeaf(unsigned int index)
+    {
+        Node &node = nodes[index];
+        node.left = -1;
+        for (unsigned int i = node.first; i < node.first + node.count; i++)
+            itemLeaf[order[i]] = index;
+    }
+
+    static unsigned int binOf(float value, float minimum, float scale)
+    {
+        int bin = (int)((value - minimum) * scale);
+        return (unsigned int)std::min(std::max(bin, 0), (int)Bins - 1);
+    }
+};
+
+#endif
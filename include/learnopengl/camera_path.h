@@ -0,0 +1,117 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/camera.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Camera flight through key poses, for replaying the same frames in every benchmark run.
+// Position, yaw and pitch are interpolated with a Catmull-Rom spline through the keys.
+//
+// File format, one key per line, sorted by time, # starts a comment:
+//   time x y z yaw pitch
+// time in seconds, yaw and pitch in degrees like Camera.
+class CameraPath
+{
+public:
+    struct Key {
+        float time = 0.0f;
+        glm::vec3 position = glm::vec3(0.0f);
+        float yaw = 0.0f;
+        float pitch = 0.0f;
+    };
+
+    // false with an error printed if the file can't be read or has fewer than two keys
+    bool Load(const std::string &path)
+    {
+        keys.clear();
+        std::ifstream in(path);
+        if (!in)
+        {
+            std::cout << "ERROR::CAMERA_PATH:: could not open " << path << std::endl;
+            return false;
+        }
+        std::string line;
+        int number = 0;
+        while (std::getline(in, line))
+        {
+            number++;
+            line = line.substr(0, line.find('#'));
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+            std::istringstream fields(line);
+            Key key;
+            if (!(fields >> key.time >> key.position.x >> key.position.y >> key.position.z >> key.yaw >> key.pitch)
+                || (!keys.empty() && key.time <= keys.back().time))
+            {
+                std::cout << "ERROR::CAMERA_PATH:: " << path << ":" << number << " is not a key after the previous one" << std::endl;
+                keys.clear();
+                return false;
+            }
+            keys.push_back(key);
+        }
+        if (keys.size() < 2)
+        {
+            std::cout << "ERROR::CAMERA_PATH:: " << path << " needs at least two keys" << std::endl;
+            keys.clear();
+            return false;
+        }
+        return true;
+    }
+
+    float Duration() const
+    {
+        return keys.empty() ? 0.0f : keys.back().time - keys.front().time;
+    }
+
+    // pose at time seconds after the first key, clamped to the path
+    Key Evaluate(float time) const
+    {
+        if (keys.empty())
+            return Key();
+        time = std::min(std::max(keys.front().time + time, keys.front().time), keys.back().time);
+        size_t next = 1;
+        while (next + 1 < keys.size() && keys[next].time < time)
+            next++;
+        // p1 -> p2 is the current segment, the end keys are repeated as their own neighbours
+        const Key &p0 = keys[next >= 2 ? next - 2 : 0];
+        const Key &p1 = keys[next - 1];
+        const Key &p2 = keys[next];
+        const Key &p3 = keys[std::min(next + 1, keys.size() - 1)];
+        float t = (time - p1.time) / (p2.time - p1.time);
+
+        Key pose;
+        pose.time = time;
+        pose.position = catmullRom(p0.position, p1.position, p2.position, p3.position, t);
+        pose.yaw = catmullRom(p0.yaw, p1.yaw, p2.yaw, p3.yaw, t);
+        pose.pitch = catmullRom(p0.pitch, p1.pitch, p2.pitch, p3.pitch, t);
+        return pose;
+    }
+
+    // moves camera to the pose at time
+    void Apply(Camera &camera, float time) const
+    {
+        Key pose = Evaluate(time);
+        camera.SetPose(pose.position, pose.yaw, pose.pitch);
+    }
+
+private:
+    std::vector<Key> keys;
+
+    template <typename T>
+    static T catmullRom(const T &p0, const T &p1, const T &p2, const T &p3, float t)
+    {
+        float t2 = t * t, t3 = t2 * t;
+        return 0.5f * ((2.0f * p1) + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2
+                       + (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+    }
+};
+
+#endif
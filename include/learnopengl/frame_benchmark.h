@@ -0,0 +1,183 @@
+#ifndef FRAME_BENCHMARK_H
+#define FRAME_BENCHMARK_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/camera.h>
+#include <learnopengl/camera_path.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Times a fixed number of frames while the camera follows a CameraPath, for --bench. The path is
+// sampled at fixed steps of its duration, so every run renders the same frames whatever the speed.
+//
+// Per measured frame it records the wall time from one BeginFrame to the next, the CPU time from
+// BeginFrame to EndFrame (recording and submitting the frame) and the GPU time between two
+// GL_TIMESTAMP queries around the frame. Timestamps don't count as GL_TIME_ELAPSED queries, so
+// the GpuTimers inside the frame keep working. The query results are only read after the last
+// frame. Warm-up frames (shader variants, texture uploads) are rendered but not counted.
+class FrameBenchmark
+{
+public:
+    struct Settings {
+        std::string pathFile;
+        int frames = 600;
+        int warmup = 30;
+        int width = 1280, height = 720;
+        std::string output;            // JSON report file, empty for stdout
+    };
+
+    // min, average and percentiles of one series, milliseconds
+    struct Summary {
+        double min = 0.0, average = 0.0, p50 = 0.0, p95 = 0.0, p99 = 0.0, max = 0.0;
+    };
+
+    Settings settings;
+
+    explicit FrameBenchmark(const Settings &settings) : settings(settings)
+    {
+    }
+
+    FrameBenchmark(const FrameBenchmark&) = delete;
+    FrameBenchmark& operator=(const FrameBenchmark&) = delete;
+
+    ~FrameBenchmark()
+    {
+        if (!queries.empty())
+            glDeleteQueries((GLsizei)queries.size(), queries.data());
+    }
+
+    bool Load()
+    {
+        return path.Load(settings.pathFile);
+    }
+
+    bool Done() const
+    {
+        return frame >= settings.warmup + settings.frames;
+    }
+
+    // puts camera on the path for this frame and starts timing it
+    void BeginFrame(Camera &camera)
+    {
+        if (queries.empty())
+        {
+            queries.resize(2 * (size_t)settings.frames);
+            glGenQueries((GLsizei)queries.size(), queries.data());
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (measured() > 0)
+            frameMs.push_back(std::chrono::duration<double, std::milli>(now - frameStart).count());
+        frameStart = now;
+
+        // warm-up frames fly the first part of the path as well
+        int total = std::max(settings.warmup + settings.frames - 1, 1);
+        path.Apply(camera, path.Duration() * frame / total);
+        if (frame >= settings.warmup)
+            glQueryCounter(queries[2 * measured()], GL_TIMESTAMP);
+    }
+
+    // after the frame has been submitted (and swapped)
+    void EndFrame()
+    {
+        if (frame >= settings.warmup)
+        {
+            glQueryCounter(queries[2 * measured() + 1], GL_TIMESTAMP);
+            cpuMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+        }
+        frame++;
+        // the last frame has no next BeginFrame, it ends when the GPU is done with it
+        if (Done())
+        {
+            glFinish();
+            frameMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+        }
+    }
+
+    // the report as JSON, renderer is the GL_RENDERER string
+    void WriteReport(std::ostream &out, const std::string &renderer)
+    {
+        std::vector<double> gpuMs;
+        for (size_t i = 0; i + 1 < queries.size() && gpuMs.size() < cpuMs.size(); i += 2)
+        {
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(queries[i + 1], GL_QUERY_RESULT, &end);
+            gpuMs.push_back((end - begin) / 1.0e6);
+        }
+
+        out << "{\n"
+            << "  \"path\": \"" << escape(settings.pathFile) << "\",\n"
+            << "  \"renderer\": \"" << escape(renderer) << "\",\n"
+            << "  \"width\": " << settings.width << ",\n"
+            << "  \"height\": " << settings.height << ",\n"
+            << "  \"frames\": " << cpuMs.size() << ",\n"
+            << "  \"warmup\": " << settings.warmup << ",\n";
+        writeSummary(out, "frame_ms", Summarize(frameMs), false);
+        writeSummary(out, "cpu_ms", Summarize(cpuMs), false);
+        writeSummary(out, "gpu_ms", Summarize(gpuMs), true);
+        out << "}" << std::endl;
+    }
+
+    // nearest-rank percentiles
+    static Summary Summarize(std::vector<double> samples)
+    {
+        Summary summary;
+        if (samples.empty())
+            return summary;
+        std::sort(samples.begin(), samples.end());
+        auto percentile = [&samples](double p) {
+            size_t rank = (size_t)std::ceil(p / 100.0 * samples.size());
+            return samples[std::min(std::max(rank, (size_t)1), samples.size()) - 1];
+        };
+        double sum = 0.0;
+        for (double sample : samples)
+            sum += sample;
+        summary.min = samples.front();
+        summary.max = samples.back();
+        summary.average = sum / samples.size();
+        summary.p50 = percentile(50.0);
+        summary.p95 = percentile(95.0);
+        summary.p99 = percentile(99.0);
+        return summary;
+    }
+
+private:
+    CameraPath path;
+    int frame = 0;
+    std::chrono::steady_clock::time_point frameStart;
+    std::vector<double> frameMs, cpuMs;
+    std::vector<unsigned int> queries;  // begin and end timestamp per measured frame
+
+    int measured() const
+    {
+        return frame - settings.warmup;
+    }
+
+    static void writeSummary(std::ostream &out, const char *name, const Summary &summary, bool last)
+    {
+        out << "  \"" << name << "\": {\"min\": " << summary.min << ", \"avg\": " << summary.average
+            << ", \"p50\": " << summary.p50 << ", \"p95\": " << summary.p95 << ", \"p99\": " << summary.p99
+            << ", \"max\": " << summary.max << "}" << (last ? "\n" : ",\n");
+    }
+
+    static std::string escape(const std::string &text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            if ((unsigned char)c >= 0x20)
+                escaped += c;
+        }
+        return escaped;
+    }
+};
+
+#endif
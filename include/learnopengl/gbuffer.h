@@ -0,0 +1,132 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/gl_state.h>
+#include <learnopengl/gpu_memory.h>
+
+#include <iostream>
+
+// Render targets of the deferred path. The geometry pass (gbuffer.fs) writes the surface of every
+// pixel, the lighting pass (deferred_lighting.fs) shades each pixel once from them:
+//   0: RGBA8   albedo, specular intensity
+//   1: RGBA16F world space normal, shininess
+//   depth: 24 bit, the world position is reconstructed from it with the inverse view-projection
+class GBuffer
+{
+public:
+    // units the lighting pass samples the targets from
+    static const unsigned int AlbedoSpecularUnit = 0;
+    static const unsigned int NormalUnit = 1;
+    static const unsigned int DepthUnit = 2;
+
+    GBuffer() = default;
+    GBuffer(const GBuffer&) = delete;
+    GBuffer& operator=(const GBuffer&) = delete;
+
+    ~GBuffer()
+    {
+        release();
+    }
+
+    // deletes the targets while the context is still there, the next Resize creates them again
+    void Release()
+    {
+        release();
+        width = height = 0;
+    }
+
+    // (re)creates the targets when the size changed, returns false if the framebuffer is unusable
+    bool Resize(int width, int height)
+    {
+        if (width == this->width && height == this->height)
+            return complete;
+        release();
+        this->width = width;
+        this->height = height;
+        if (width <= 0 || height <= 0)
+            return complete = false;
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        textures[0] = createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        textures[1] = createTarget(GL_RGBA16F, GL_RGBA, GL_FLOAT);
+        textures[2] = createTarget(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[0], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, textures[1], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, textures[2], 0);
+        const GLenum drawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+        glDrawBuffers(2, drawBuffers);
+
+        complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        if (!complete)
+            std::cout << "ERROR::GBUFFER:: framebuffer " << width << "x" << height << " is not complete" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return complete;
+    }
+
+    // draws into the targets from here on, cleared to no surface
+    void BeginGeometryPass()
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    // back to target, the framebuffer the lighting pass draws into
+    void EndGeometryPass(unsigned int target = 0)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+    }
+
+    void BindTextures() const
+    {
+        GLState &state = GLState::Instance();
+        state.BindTexture(AlbedoSpecularUnit, GL_TEXTURE_2D, textures[0]);
+        state.BindTexture(NormalUnit, GL_TEXTURE_2D, textures[1]);
+        state.BindTexture(DepthUnit, GL_TEXTURE_2D, textures[2]);
+    }
+
+    bool Complete() const
+    {
+        return complete;
+    }
+
+private:
+    unsigned int framebuffer = 0;
+    unsigned int textures[3] = {0, 0, 0};
+    int width = 0, height = 0;
+    bool complete = false;
+
+    // one pixel per texel and nothing to filter, the lighting pass reads them with texelFetch
+    unsigned int createTarget(GLenum internalFormat, GLenum format, GLenum type)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        GLState::Instance().BindTexture(AlbedoSpecularUnit, GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+        GpuMemory::Instance().TrackTexture(texture, internalFormat, width, height, 1, 1, GpuMemory::RenderTarget, "G-buffer");
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    void release()
+    {
+        for (unsigned int &texture : textures)
+        {
+            if (texture != 0)
+                GLState::Instance().DeleteTexture(texture);
+            texture = 0;
+        }
+        if (framebuffer != 0)
+            glDeleteFramebuffers(1, &framebuffer);
+        framebuffer = 0;
+        complete = false;
+    }
+};
+
+#endif
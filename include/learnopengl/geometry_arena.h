@@ -0,0 +1,218 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/gl_state.h>
+#include <learnopengl/gpu_memory.h>
+#include <learnopengl/mesh.h>
+
+#include <deque>
+#include <iostream>
+#include <vector>
+
+// One vertex buffer and one index buffer shared by all static meshes of the scene.
+// Meshes are appended with Add and keep an ArenaRange (first index, index count, base vertex)
+// into the shared buffers. After Build every mesh in the arena draws with glDrawElementsBaseVertex
+// from the same VAO, so the whole static scene needs a single VAO bind per frame. Build copies every
+// mesh into the buffers straight from its MeshData (the mapped mesh cache file for cached models),
+// nothing is gathered on the CPU first.
+//
+// A second VAO reads the same indices with only the positions, packed into their own buffer, for
+// passes that need nothing else (depth pre-pass). Ranges are valid in both.
+class GeometryArena
+{
+public:
+    GeometryArena() = default;
+    GeometryArena(const GeometryArena&) = delete;
+    GeometryArena& operator=(const GeometryArena&) = delete;
+
+    // appends raw geometry, for meshes that are not Mesh objects (e.g. the parking quad).
+    // indices are relative to the first of the given vertices.
+    ArenaRange Add(const vector<Vertex> &meshVertices, const vector<unsigned int> &meshIndices)
+    {
+        rawGeometry.emplace_back();
+        rawGeometry.back().vertices = meshVertices;
+        rawGeometry.back().indices = meshIndices;
+        return append(rawGeometry.back(), nullptr);
+    }
+
+    // appends the geometry of mesh. The mesh is switched over to the arena in Build,
+    // so it must stay at the same address until then.
+    ArenaRange Add(Mesh &mesh)
+    {
+        return append(mesh.Geometry(), &mesh);
+    }
+
+    // uploads everything that was added and moves the meshes over to the shared buffers.
+    // nothing can be added afterwards.
+    void Build()
+    {
+        if (vao != 0)
+        {
+            std::cout << "ERROR::GEOMETRY_ARENA:: already built" << std::endl;
+            return;
+        }
+        glGenVertexArrays(1, &vao);
+        glGenBuffers(1, &vbo);
+        glGenBuffers(1, &ebo);
+        glGenBuffers(1, &instanceBuffer);
+
+        GLState::Instance().BindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), nullptr, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(unsigned int), nullptr, GL_STATIC_DRAW);
+        vector<glm::vec3> positions(vertexCount);
+        for (const Member &member : members)
+        {
+            const MeshData &data = *member.data;
+            glBufferSubData(GL_ARRAY_BUFFER, member.range.baseVertex * sizeof(Vertex), data.VertexCount() * sizeof(Vertex),
+                            data.VertexData());
+            glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, member.range.firstIndex * sizeof(unsigned int),
+                            data.IndexCount() * sizeof(unsigned int), data.IndexData());
+            for (size_t i = 0; i < data.VertexCount(); i++)
+                positions[member.range.baseVertex + i] = data.VertexData()[i].Position;
+        }
+        GpuMemory::Instance().TrackBuffer(vbo, vertexCount * sizeof(Vertex), GpuMemory::Geometry, "Geometry arena vertices");
+        GpuMemory::Instance().TrackBuffer(ebo, indexCount * sizeof(unsigned int), GpuMemory::Geometry, "Geometry arena indices");
+        Mesh::EnableVertexAttributes();
+        Mesh::EnableInstanceAttributes(instanceBuffer);
+        GLState::Instance().BindVertexArray(0);
+
+        glGenVertexArrays(1, &positionVAO);
+        glGenBuffers(1, &positionBuffer);
+        GLState::Instance().BindVertexArray(positionVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
+        glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+        GpuMemory::Instance().TrackBuffer(positionBuffer, positions.size() * sizeof(glm::vec3), GpuMemory::Geometry,
+                                          "Geometry arena positions");
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        Mesh::EnableInstanceAttributes(instanceBuffer);
+        GLState::Instance().BindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        unsigned int meshes = 0;
+        for (Member &member : members)
+        {
+            if (!member.mesh)
+                continue;
+            member.mesh->UseArena(vao, member.range);
+            meshes++;
+        }
+
+        std::cout << "GEOMETRY_ARENA::BUILD " << meshes << " meshes, " << vertexCount << " vertices, "
+                  << indexCount << " indices, "
+                  << ((size_t)vertexCount * (sizeof(Vertex) + sizeof(glm::vec3)) + (size_t)indexCount * sizeof(unsigned int)) / 1024
+                  << " KB" << std::endl;
+
+        // the GPU copy is all that is needed from here on
+        members.clear();
+        rawGeometry.clear();
+    }
+
+    void Bind() const
+    {
+        GLState::Instance().BindVertexArray(vao);
+    }
+
+    // per-instance model matrices read by DrawInstanced through attribute locations 5-8
+    void UploadInstances(const vector<glm::mat4> &instances)
+    {
+        // orphan the previous matrices so the driver doesn't wait for draws still reading them
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(glm::mat4), instances.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        GpuMemory::Instance().TrackBuffer(instanceBuffer, instances.size() * sizeof(glm::mat4), GpuMemory::DynamicBuffer,
+                                          "Geometry arena instances");
+    }
+
+    // deletes the shared buffers and VAOs. Meshes that were moved here can't be drawn any more,
+    // release their models first.
+    void Release()
+    {
+        GLState &state = GLState::Instance();
+        for (unsigned int *array : {&vao, &positionVAO})
+        {
+            if (*array != 0)
+                state.DeleteVertexArray(*array);
+            *array = 0;
+        }
+        for (unsigned int *buffer : {&vbo, &ebo, &instanceBuffer, &positionBuffer})
+        {
+            if (*buffer != 0)
+            {
+                glDeleteBuffers(1, buffer);
+                GpuMemory::Instance().Release(GpuMemory::Buffer, *buffer);
+            }
+            *buffer = 0;
+        }
+        vertexCount = indexCount = 0;
+    }
+
+    // draws a range that was added as raw geometry, the arena has to be bound
+    static void Draw(const ArenaRange &range)
+    {
+        glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, range.IndexOffset(), range.baseVertex);
+    }
+
+    unsigned int VAO() const
+    {
+        return vao;
+    }
+
+    // positions only, same indices and instance matrices as VAO()
+    unsigned int PositionVAO() const
+    {
+        return positionVAO;
+    }
+
+    bool Built() const
+    {
+        return vao != 0;
+    }
+
+    unsigned int VertexCount() const
+    {
+        return vertexCount;
+    }
+
+    unsigned int IndexCount() const
+    {
+        return indexCount;
+    }
+
+private:
+    struct Member {
+        const MeshData *data;
+        Mesh *mesh;                        // null for raw geometry
+        ArenaRange range;
+    };
+
+    unsigned int vao = 0, vbo = 0, ebo = 0, instanceBuffer = 0;
+    unsigned int positionVAO = 0, positionBuffer = 0;
+    // everything added so far, the size of the buffers once built
+    unsigned int vertexCount = 0, indexCount = 0;
+    vector<Member> members;
+    // copies of the raw geometry until Build, a deque so the members can point into it
+    std::deque<MeshData> rawGeometry;
+
+    ArenaRange append(const MeshData &data, Mesh *mesh)
+    {
+        ArenaRange range;
+        range.firstIndex = indexCount;
+        range.indexCount = (unsigned int)data.IndexCount();
+        range.baseVertex = (int)vertexCount;
+        vertexCount += (unsigned int)data.VertexCount();
+        indexCount += (unsigned int)data.IndexCount();
+        members.push_back(Member{&data, mesh, range});
+        return range;
+    }
+};
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/gpu_memory.h>
+
+// Shadow copy of the GL state the renderer touches every frame: bound program, VAO, active unit,
+// per-unit texture bindings, the depth/blend/cull switches and the write masks. Every call goes
+// through here and is dropped when it would not change anything. Code that changes this state
+// behind its back has to call Invalidate afterwards (the ImGui backend restores what it changes,
+// so it does not).
+//
+// Textures and VAOs must be deleted through DeleteTexture/DeleteVertexArray, otherwise a
+// recycled name could be mistaken for one that is still bound.
+class GLState
+{
+public:
+    static const unsigned int MaxTextureUnits = 16;
+
+    struct Counters {
+        unsigned int issued = 0;
+        unsigned int skipped = 0;
+    };
+
+    static GLState &Instance()
+    {
+        static GLState state;
+        return state;
+    }
+
+    void UseProgram(unsigned int program)
+    {
+        if (set(currentProgram, program))
+            glUseProgram(program);
+    }
+
+    void BindVertexArray(unsigned int vao)
+    {
+        if (set(currentVAO, vao))
+            glBindVertexArray(vao);
+    }
+
+    void ActiveTexture(unsigned int unit)
+    {
+        if (set(activeUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    // binds texture on the active unit
+    void BindTexture(GLenum target, unsigned int texture)
+    {
+        int slot = targetSlot(target);
+        if (slot < 0 || activeUnit >= MaxTextureUnits)
+        {
+            glBindTexture(target, texture);
+            counters.issued++;
+            return;
+        }
+        if (set(textures[activeUnit][slot], texture))
+            glBindTexture(target, texture);
+    }
+
+    // binds texture on unit, the active unit only changes if the binding does
+    void BindTexture(unsigned int unit, GLenum target, unsigned int texture)
+    {
+        int slot = targetSlot(target);
+        if (slot >= 0 && unit < MaxTextureUnits && textures[unit][slot] == texture)
+        {
+            counters.skipped++;
+            return;
+        }
+        ActiveTexture(unit);
+        BindTexture(target, texture);
+    }
+
+    // GL_DEPTH_TEST, GL_BLEND or GL_CULL_FACE; anything else is passed through
+    void SetEnabled(GLenum capability, bool enabled)
+    {
+        int *shadow = nullptr;
+        if (capability == GL_DEPTH_TEST)
+            shadow = &depthTest;
+        else if (capability == GL_BLEND)
+            shadow = &blend;
+        else if (capability == GL_CULL_FACE)
+            shadow = &cullFace;
+
+        if (shadow && !set(*shadow, (int)enabled))
+            return;
+        if (!shadow)
+            counters.issued++;
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+    }
+
+    void Enable(GLenum capability)
+    {
+        SetEnabled(capability, true);
+    }
+
+    void Disable(GLenum capability)
+    {
+        SetEnabled(capability, false);
+    }
+
+    void DepthMask(bool write)
+    {
+        if (set(depthMask, (int)write))
+            glDepthMask(write ? GL_TRUE : GL_FALSE);
+    }
+
+    // all four color channels together
+    void ColorMask(bool write)
+    {
+        if (set(colorMask, (int)write))
+            glColorMask(write, write, write, write);
+    }
+
+    void DepthFunc(GLenum function)
+    {
+        if (set(depthFunc, function))
+            glDepthFunc(function);
+    }
+
+    void BlendFunc(GLenum source, GLenum destination)
+    {
+        if (blendSource == source && blendDestination == destination)
+        {
+            counters.skipped++;
+            return;
+        }
+        blendSource = source;
+        blendDestination = destination;
+        counters.issued++;
+        glBlendFunc(source, destination);
+    }
+
+    void DeleteTexture(unsigned int texture)
+    {
+        for (unsigned int unit = 0; unit < MaxTextureUnits; unit++)
+            for (unsigned int slot = 0; slot < TargetSlots; slot++)
+                if (textures[unit][slot] == texture)
+                    textures[unit][slot] = 0;
+        glDeleteTextures(1, &texture);
+        GpuMemory::Instance().Release(GpuMemory::Texture, texture);
+    }
+
+    void DeleteVertexArray(unsigned int vao)
+    {
+        if (currentVAO == vao)
+            currentVAO = 0;
+        glDeleteVertexArrays(1, &vao);
+    }
+
+    // forget everything, the next call of each kind is issued unconditionally
+    void Invalidate()
+    {
+        currentProgram = currentVAO = activeUnit = Unknown;
+        for (unsigned int unit = 0; unit < MaxTextureUnits; unit++)
+            for (unsigned int slot = 0; slot < TargetSlots; slot++)
+                textures[unit][slot] = Unknown;
+        depthTest = blend = cullFace = depthMask = colorMask = -1;
+        depthFunc = blendSource = blendDestination = Unknown;
+    }
+
+    const Counters &FrameCounters() const
+    {
+        return counters;
+    }
+
+    // call once per frame, before the first draw
+    void ResetCounters()
+    {
+        counters = Counters();
+    }
+
+private:
+    // 2D, cube map, 2D array and buffer textures are tracked, other targets are passed through
+    static const unsigned int TargetSlots = 4;
+    // never a valid name or enum, so the next call after Invalidate always goes through
+    static const unsigned int Unknown = 0xffffffffu;
+
+    Counters counters;
+
+    unsigned int currentProgram, currentVAO, activeUnit;
+    unsigned int textures[MaxTextureUnits][TargetSlots];
+    int depthTest, blend, cullFace, depthMask, colorMask;
+    GLenum depthFunc, blendSource, blendDestination;
+
+    GLState()
+    {
+        Invalidate();
+    }
+
+    static int targetSlot(GLenum target)
+    {
+        switch (target)
+        {
+            case GL_TEXTURE_2D: return 0;
+            case GL_TEXTURE_CUBE_MAP: return 1;
+            case GL_TEXTURE_2D_ARRAY: return 2;
+            case GL_TEXTURE_BUFFER: return 3;
+            default: return -1;
+        }
+    }
+
+    // updates the shadow value, returns whether the GL call has to be made
+    template <typename T>
+    bool set(T &shadow, T value)
+    {
+        if (shadow == value)
+        {
+            counters.skipped++;
+            return false;
+        }
+        shadow = value;
+        counters.issued++;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,328 @@
+#ifndef GOLDEN_IMAGES_H
+#define GOLDEN_IMAGES_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <stb_image.h>
+#include <stb_image_write.h>
+
+#include <learnopengl/camera.h>
+#include <learnopengl/frame_benchmark.h>
+
+#include <sys/stat.h>
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Regression check of the rendered picture, for --golden and --golden-update. Renders a fixed list
+// of camera poses in the headless context, reads each picture back through a pixel buffer object and
+// compares it with the PNG of the same name in the golden directory, or replaces that PNG on update.
+//
+// Two pictures match when at most maxBadPixels of their pixels are further apart than threshold in
+// YIQ space (the colour distance pixelmatch uses), so rounding differences pass while a missing
+// shadow or a changed material does not. A pose that doesn't match leaves <name>.actual.png and
+// <name>.diff.png (differing pixels in red) next to its golden.
+//
+// Every pose is drawn warmup times before it is timed, the occlusion culler needs the depth of the
+// frames before. The last of the timed frames is read back. CPU and GPU times per pose go into the
+// report, so a performance change can be checked against the pictures in the same run.
+//
+// Poses file, one pose per line, # starts a comment:
+//   name x y z yaw pitch
+class GoldenImages
+{
+public:
+    struct Settings {
+        std::string posesFile;
+        std::string directory = "resources/golden";
+        bool update = false;               // write the goldens instead of comparing
+        int width = 800, height = 600;
+        int warmup = 3;
+        int frames = 10;
+        float threshold = 0.1f;            // YIQ distance of a differing pixel, 0..1
+        double maxBadPixels = 0.001;       // fraction of differing pixels a match may have
+    };
+
+    struct Pose {
+        std::string name;
+        glm::vec3 position = glm::vec3(0.0f);
+        float yaw = 0.0f;
+        float pitch = 0.0f;
+    };
+
+    struct Result {
+        std::string name;
+        bool matched = false;
+        bool missing = false;              // no golden to compare with
+        double badPixels = 0.0;            // fraction of pixels that differ
+        FrameBenchmark::Summary cpuMs, gpuMs;
+    };
+
+    Settings settings;
+
+    explicit GoldenImages(const Settings &settings) : settings(settings)
+    {
+    }
+
+    GoldenImages(const GoldenImages&) = delete;
+    GoldenImages& operator=(const GoldenImages&) = delete;
+
+    ~GoldenImages()
+    {
+        if (!queries.empty())
+            glDeleteQueries((GLsizei)queries.size(), queries.data());
+        if (pixelBuffer != 0)
+            glDeleteBuffers(1, &pixelBuffer);
+    }
+
+    // false with an error printed if the poses file can't be read or is empty
+    bool Load()
+    {
+        poses.clear();
+        std::ifstream in(settings.posesFile);
+        if (!in)
+        {
+            std::cout << "ERROR::GOLDEN:: could not open " << settings.posesFile << std::endl;
+            return false;
+        }
+        std::string line;
+        int number = 0;
+        while (std::getline(in, line))
+        {
+            number++;
+            line = line.substr(0, line.find('#'));
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+            std::istringstream fields(line);
+            Pose pose;
+            if (!(fields >> pose.name >> pose.position.x >> pose.position.y >> pose.position.z >> pose.yaw >> pose.pitch))
+            {
+                std::cout << "ERROR::GOLDEN:: " << settings.posesFile << ":" << number << " is not a pose" << std::endl;
+                poses.clear();
+                return false;
+            }
+            poses.push_back(pose);
+        }
+        if (poses.empty())
+        {
+            std::cout << "ERROR::GOLDEN:: " << settings.posesFile << " has no poses" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    bool Done() const
+    {
+        return pose >= poses.size();
+    }
+
+    // puts camera on the current pose and starts timing the frame if it counts
+    void BeginFrame(Camera &camera)
+    {
+        if (queries.empty())
+        {
+            queries.resize(2 * (size_t)settings.frames);
+            glGenQueries((GLsizei)queries.size(), queries.data());
+        }
+        const Pose &current = poses[pose];
+        camera.SetPose(current.position, current.yaw, current.pitch);
+        frameStart = std::chrono::steady_clock::now();
+        if (timed() >= 0)
+            glQueryCounter(queries[2 * timed()], GL_TIMESTAMP);
+    }
+
+    // before the swap, with the finished picture in framebuffer 0
+    void EndFrame()
+    {
+        if (timed() >= 0)
+        {
+            glQueryCounter(queries[2 * timed() + 1], GL_TIMESTAMP);
+            cpuMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+        }
+        if (++frame < settings.warmup + settings.frames)
+            return;
+
+        Result result;
+        result.name = poses[pose].name;
+        check(readBack(), result);
+        std::vector<double> gpuMs;
+        for (size_t i = 0; i < cpuMs.size(); i++)
+        {
+            GLuint64 begin = 0, end = 0;
+            glGetQueryObjectui64v(queries[2 * i], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(queries[2 * i + 1], GL_QUERY_RESULT, &end);
+            gpuMs.push_back((end - begin) / 1.0e6);
+        }
+        result.cpuMs = FrameBenchmark::Summarize(cpuMs);
+        result.gpuMs = FrameBenchmark::Summarize(gpuMs);
+        results.push_back(result);
+        cpuMs.clear();
+        frame = 0;
+        pose++;
+    }
+
+    // one line per pose, returns the exit code: 0 if every pose matched or was updated, 1 otherwise (a
+    // missing golden fails too)
+    int Report(std::ostream &out) const
+    {
+        unsigned int matched = 0, missing = 0;
+        std::streamsize precision = out.precision();
+        for (const Result &result : results)
+        {
+            out << "GOLDEN:: " << std::left << std::setw(16) << result.name << std::right;
+            if (settings.update)
+                out << (result.matched ? "updated" : "NOT WRITTEN");
+            else if (result.missing)
+                out << "NO GOLDEN";
+            else
+                out << (result.matched ? "ok     " : "DIFFERS") << " (" << std::fixed << std::setprecision(3)
+                    << result.badPixels * 100.0 << "% pixels)";
+            out << std::fixed << std::setprecision(2) << ", cpu p50 " << result.cpuMs.p50 << " ms, gpu p50 "
+                << result.gpuMs.p50 << " ms, gpu p95 " << result.gpuMs.p95 << " ms" << std::endl;
+            out.unsetf(std::ios::floatfield);
+            out.precision(precision);
+            if (result.matched)
+                matched++;
+            if (result.missing)
+                missing++;
+        }
+        out << "GOLDEN:: " << matched << "/" << poses.size() << " poses "
+            << (settings.update ? "written to " : "match the goldens in ") << settings.directory << std::endl;
+        if (missing != 0)
+            out << "GOLDEN:: " << missing << " goldens missing in " << settings.directory
+                << ", write them with --golden-update" << std::endl;
+        return matched == poses.size() ? 0 : 1;
+    }
+
+private:
+    std::vector<Pose> poses;
+    std::vector<Result> results;
+    size_t pose = 0;
+    int frame = 0;                         // of the current pose, warm-up frames included
+    std::chrono::steady_clock::time_point frameStart;
+    std::vector<double> cpuMs;
+    std::vector<unsigned int> queries;     // begin and end timestamp per timed frame
+    unsigned int pixelBuffer = 0;
+
+    // index of the frame among the timed frames of the pose, negative while warming up
+    int timed() const
+    {
+        return frame - settings.warmup;
+    }
+
+    // RGB rows top to bottom
+    std::vector<unsigned char> readBack()
+    {
+        size_t bytes = (size_t)settings.width * settings.height * 4;
+        if (pixelBuffer == 0)
+            glGenBuffers(1, &pixelBuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pixelBuffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+        glReadPixels(0, 0, settings.width, settings.height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+        std::vector<unsigned char> picture((size_t)settings.width * settings.height * 3);
+        const unsigned char *pixels = (const unsigned char *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+        if (pixels)
+        {
+            // GL rows go bottom to top
+            for (int y = 0; y < settings.height; y++)
+            {
+                const unsigned char *source = pixels + (size_t)(settings.height - 1 - y) * settings.width * 4;
+                unsigned char *destination = picture.data() + (size_t)y * settings.width * 3;
+                for (int x = 0; x < settings.width; x++)
+                    memcpy(destination + 3 * x, source + 4 * x, 3);
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        else
+        {
+            std::cout << "ERROR::GOLDEN:: could not map the pixel buffer" << std::endl;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return picture;
+    }
+
+    void check(const std::vector<unsigned char> &picture, Result &result)
+    {
+        std::string base = settings.directory + "/" + result.name;
+        if (settings.update)
+        {
+            mkdir(settings.directory.c_str(), 0755);
+            result.matched = write(base + ".png", picture);
+            return;
+        }
+
+        int width = 0, height = 0, components = 0;
+        unsigned char *expected = stbi_load((base + ".png").c_str(), &width, &height, &components, 3);
+        if (!expected)
+        {
+            result.missing = true;
+            write(base + ".actual.png", picture);
+            return;
+        }
+
+        std::vector<unsigned char> diff(picture.size());
+        size_t pixels = (size_t)settings.width * settings.height, bad = pixels;
+        bool sameSize = width == settings.width && height == settings.height;
+        if (sameSize)
+        {
+            // pixelmatch: the largest possible YIQ distance is 35215
+            float limit = 35215.0f * settings.threshold * settings.threshold;
+            bad = 0;
+            for (size_t i = 0; i < pixels; i++)
+            {
+                const unsigned char *a = &picture[3 * i], *b = expected + 3 * i;
+                unsigned char *marked = &diff[3 * i];
+                if (colorDelta(a, b) > limit)
+                {
+                    bad++;
+                    marked[0] = 255;
+                    marked[1] = marked[2] = 0;
+                }
+                else
+                {
+                    // faded grey of the golden, so the red pixels stand out
+                    unsigned char grey = (unsigned char)(192 + (b[0] * 77 + b[1] * 150 + b[2] * 29) / 256 / 4);
+                    marked[0] = marked[1] = marked[2] = grey;
+                }
+            }
+        }
+        stbi_image_free(expected);
+
+        result.badPixels = (double)bad / pixels;
+        result.matched = result.badPixels <= settings.maxBadPixels;
+        if (!result.matched)
+        {
+            write(base + ".actual.png", picture);
+            if (sameSize)
+                write(base + ".diff.png", diff);
+        }
+    }
+
+    bool write(const std::string &path, const std::vector<unsigned char> &picture) const
+    {
+        if (stbi_write_png(path.c_str(), settings.width, settings.height, 3, picture.data(), settings.width * 3))
+            return true;
+        std::cout << "ERROR::GOLDEN:: could not write " << path << std::endl;
+        return false;
+    }
+
+    // perceived distance of two RGB colours in YIQ space (Kotsarenko and Ramos), 0..35215
+    static float colorDelta(const unsigned char *a, const unsigned char *b)
+    {
+        float r = (float)a[0] - b[0], g = (float)a[1] - b[1], bl = (float)a[2] - b[2];
+        float y = r * 0.29889531f + g * 0.58662247f + bl * 0.11448223f;
+        float i = r * 0.59597799f - g * 0.27417610f - bl * 0.32180189f;
+        float q = r * 0.21147017f - g * 0.52261711f + bl * 0.31114694f;
+        return 0.5053f * y * y + 0.299f * i * i + 0.1957f * q * q;
+    }
+};
+
+#endif
@@ -0,0 +1,291 @@
+#ifndef GPU_MEMORY_H
+#define GPU_MEMORY_H
+
+#include <glad/glad.h>
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Book of every buffer, texture and renderbuffer the program gave storage to: size, format,
+// dimensions, mip levels and the asset or system it belongs to. Code that allocates calls Track*
+// after glBufferData / glTexImage* (again when the storage changes, the entry is replaced) and
+// Release when it deletes the object. GLState::DeleteTexture releases textures by itself.
+//
+// The sizes are what was asked for, the driver may pad (RGB8 is usually stored as RGBA8) or
+// compress. Only used from the GL thread.
+class GpuMemory
+{
+public:
+    enum Kind {
+        Buffer,
+        Texture,
+        Renderbuffer
+    };
+
+    // Geometry and AssetTexture belong to the scene and must be gone once it is released,
+    // see ReportLeaks
+    enum Category {
+        Geometry,
+        AssetTexture,
+        RenderTarget,
+        DynamicBuffer,
+        CategoryCount
+    };
+
+    struct Allocation {
+        Kind kind = Buffer;
+        unsigned int name = 0;
+        Category category = DynamicBuffer;
+        std::string owner;
+        GLenum format = 0;                 // internal format, 0 for buffers
+        int width = 0, height = 0;
+        int layers = 1;                    // array layers or cube faces
+        int levels = 1;
+        size_t bytes = 0;
+        size_t fileBytes = 0;              // size of the image file a texture was loaded from, 0 if none
+    };
+
+    static GpuMemory &Instance()
+    {
+        static GpuMemory memory;
+        return memory;
+    }
+
+    GpuMemory(const GpuMemory&) = delete;
+    GpuMemory& operator=(const GpuMemory&) = delete;
+
+    void TrackBuffer(unsigned int buffer, size_t bytes, Category category, const std::string &owner)
+    {
+        Allocation allocation;
+        allocation.kind = Buffer;
+        allocation.name = buffer;
+        allocation.category = category;
+        allocation.owner = owner;
+        allocation.bytes = bytes;
+        track(allocation);
+    }
+
+    // levels is the number of mip levels with storage, see MipLevels
+    void TrackTexture(unsigned int texture, GLenum internalFormat, int width, int height, int layers, int levels,
+                      Category category, const std::string &owner, size_t fileBytes = 0)
+    {
+        Allocation allocation;
+        allocation.kind = Texture;
+        allocation.name = texture;
+        allocation.category = category;
+        allocation.owner = owner;
+        allocation.format = internalFormat;
+        allocation.width = width;
+        allocation.height = height;
+        allocation.layers = layers;
+        allocation.levels = levels;
+        allocation.bytes = TextureBytes(internalFormat, width, height, layers, levels);
+        allocation.fileBytes = fileBytes;
+        track(allocation);
+    }
+
+    void TrackRenderbuffer(unsigned int renderbuffer, GLenum internalFormat, int width, int height, const std::string &owner)
+    {
+        Allocation allocation;
+        allocation.kind = Renderbuffer;
+        allocation.name = renderbuffer;
+        allocation.category = RenderTarget;
+        allocation.owner = owner;
+        allocation.format = internalFormat;
+        allocation.width = width;
+        allocation.height = height;
+        allocation.bytes = TextureBytes(internalFormat, width, height, 1, 1);
+        track(allocation);
+    }
+
+    void Release(Kind kind, unsigned int name)
+    {
+        auto found = allocations.find(key(kind, name));
+        if (found == allocations.end())
+            return;
+        totals[found->second.category] -= found->second.bytes;
+        allocations.erase(found);
+    }
+
+    size_t TotalBytes() const
+    {
+        size_t total = 0;
+        for (size_t bytes : totals)
+            total += bytes;
+        return total;
+    }
+
+    size_t Bytes(Category category) const
+    {
+        return totals[category];
+    }
+
+    size_t Count() const
+    {
+        return allocations.size();
+    }
+
+    // biggest first
+    std::vector<const Allocation*> Sorted() const
+    {
+        std::vector<const Allocation*> sorted;
+        for (const auto &entry : allocations)
+            sorted.push_back(&entry.second);
+        std::sort(sorted.begin(), sorted.end(), [](const Allocation *a, const Allocation *b) {
+            return a->bytes != b->bytes ? a->bytes > b->bytes : a->owner < b->owner;
+        });
+        return sorted;
+    }
+
+    // totals per category and one line per allocation, for --mem-report
+    void Report(std::ostream &out) const
+    {
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(2) << "GPU_MEMORY:: " << allocations.size() << " allocations, "
+             << megabytes(TotalBytes()) << " MB";
+        for (int category = 0; category < CategoryCount; category++)
+            line << ", " << CategoryName((Category)category) << " " << megabytes(totals[category]) << " MB";
+        out << line.str() << std::endl;
+        for (const Allocation *allocation : Sorted())
+            out << "GPU_MEMORY:: " << describe(*allocation) << std::endl;
+    }
+
+    // geometry and asset textures that are still alive. Returns their number.
+    unsigned int ReportLeaks(std::ostream &out) const
+    {
+        unsigned int leaks = 0;
+        for (const Allocation *allocation : Sorted())
+        {
+            if (allocation->category != Geometry && allocation->category != AssetTexture)
+                continue;
+            out << "GPU_MEMORY::LEAK " << describe(*allocation) << std::endl;
+            leaks++;
+        }
+        return leaks;
+    }
+
+    static const char *CategoryName(Category category)
+    {
+        static const char *names[CategoryCount] = {"geometry", "textures", "render targets", "dynamic buffers"};
+        return names[category];
+    }
+
+    static const char *KindName(Kind kind)
+    {
+        static const char *names[3] = {"buffer", "texture", "renderbuffer"};
+        return names[kind];
+    }
+
+    static const char *FormatName(GLenum format)
+    {
+        switch (format)
+        {
+            case 0: return "-";
+            case GL_RED: case GL_R8: return "R8";
+            case GL_RG: case GL_RG8: return "RG8";
+            case GL_RGB: case GL_RGB8: return "RGB8";
+            case GL_RGBA: case GL_RGBA8: return "RGBA8";
+            case GL_R16F: return "R16F";
+            case GL_RGB16F: return "RGB16F";
+            case GL_RGBA16F: return "RGBA16F";
+            case GL_R11F_G11F_B10F: return "R11G11B10F";
+            case GL_R32F: return "R32F";
+            case GL_RGB32F: return "RGB32F";
+            case GL_RGBA32F: return "RGBA32F";
+            case GL_DEPTH_COMPONENT24: return "DEPTH24";
+            case GL_DEPTH_COMPONENT32F: return "DEPTH32F";
+            case GL_DEPTH24_STENCIL8: return "DEPTH24_STENCIL8";
+            default: return "other";
+        }
+    }
+
+    static size_t TexelBytes(GLenum format)
+    {
+        switch (format)
+        {
+            case GL_RED: case GL_R8: return 1;
+            case GL_RG: case GL_RG8: case GL_R16F: return 2;
+            case GL_RGB: case GL_RGB8: return 3;
+            case GL_RGB16F: return 6;
+            case GL_RGBA16F: return 8;
+            case GL_RGB32F: return 12;
+            case GL_RGBA32F: return 16;
+            default: return 4;
+        }
+    }
+
+    // full mip chain of a width x height image
+    static int MipLevels(int width, int height)
+    {
+        int levels = 1;
+        for (int size = std::max(width, height); size > 1; size /= 2)
+            levels++;
+        return levels;
+    }
+
+    static size_t TextureBytes(GLenum format, int width, int height, int layers, int levels)
+    {
+        size_t bytes = 0;
+        for (int level = 0; level < levels; level++)
+            bytes += (size_t)std::max(width >> level, 1) * std::max(height >> level, 1);
+        return bytes * layers * TexelBytes(format);
+    }
+
+    // size of the file at path, 0 if it can't be read
+    static size_t FileBytes(const std::string &path)
+    {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 ? (size_t)info.st_size : 0;
+    }
+
+private:
+    std::unordered_map<uint64_t, Allocation> allocations;
+    size_t totals[CategoryCount] = {};
+
+    GpuMemory() = default;
+
+    static uint64_t key(Kind kind, unsigned int name)
+    {
+        return ((uint64_t)kind << 32) | name;
+    }
+
+    void track(const Allocation &allocation)
+    {
+        Release(allocation.kind, allocation.name);
+        allocations[key(allocation.kind, allocation.name)] = allocation;
+        totals[allocation.category] += allocation.bytes;
+    }
+
+    static double megabytes(size_t bytes)
+    {
+        return bytes / (1024.0 * 1024.0);
+    }
+
+    static std::string describe(const Allocation &allocation)
+    {
+        std::ostringstream line;
+        line << std::fixed << std::setprecision(2) << std::setw(8) << megabytes(allocation.bytes) << " MB  "
+             << KindName(allocation.kind) << " " << allocation.name << " (" << CategoryName(allocation.category) << ")";
+        if (allocation.kind != Buffer)
+        {
+            line << " " << FormatName(allocation.format) << " " << allocation.width << "x" << allocation.height;
+            if (allocation.layers > 1)
+                line << "x" << allocation.layers;
+            line << ", " << allocation.levels << (allocation.levels == 1 ? " level" : " levels");
+        }
+        if (allocation.fileBytes > 0)
+            line << ", file " << megabytes(allocation.fileBytes) << " MB";
+        line << "  " << allocation.owner;
+        return line.str();
+    }
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <glad/glad.h>
+
+// GPU time between Begin and End, measured with GL_TIME_ELAPSED queries. Results are read a few
+// frames later from a small ring of queries, so reading never waits for the GPU. Only one
+// GL_TIME_ELAPSED query can be active at a time, timers can't be nested.
+class GpuTimer
+{
+public:
+    static const unsigned int Latency = 4;
+
+    GpuTimer() = default;
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    ~GpuTimer()
+    {
+        Release();
+    }
+
+    // deletes the queries while the context is still there, Begin creates them again if needed
+    void Release()
+    {
+        if (queries[0] != 0)
+            glDeleteQueries(Latency, queries);
+        for (unsigned int i = 0; i < Latency; i++)
+        {
+            queries[i] = 0;
+            pending[i] = false;
+        }
+    }
+
+    void Begin()
+    {
+        if (queries[0] == 0)
+            glGenQueries(Latency, queries);
+        collect();
+        glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+    }
+
+    void End()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        pending[next] = true;
+        next = (next + 1) % Latency;
+    }
+
+    // latest finished measurement
+    double Milliseconds() const
+    {
+        return last;
+    }
+
+    // exponential moving average over the finished measurements
+    double AverageMilliseconds() const
+    {
+        return average;
+    }
+
+    // forget the average, e.g. after switching what is being measured
+    void ResetAverage()
+    {
+        samples = 0;
+        average = 0.0;
+    }
+
+private:
+    unsigned int queries[Latency] = {};
+    bool pending[Latency] = {};
+    unsigned int next = 0;
+    double last = 0.0;
+    double average = 0.0;
+    unsigned int samples = 0;
+
+    // reads every query whose result is there, oldest first, and stops at the first one that isn't
+    void collect()
+    {
+        for (unsigned int i = 0; i < Latency; i++)
+        {
+            unsigned int query = (next + i) % Latency;
+            if (!pending[query])
+                continue;
+            GLint available = 0;
+            glGetQueryObjectiv(queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(queries[query], GL_QUERY_RESULT, &nanoseconds);
+            pending[query] = false;
+            last = nanoseconds / 1.0e6;
+            samples++;
+            average = samples == 1 ? last : average + (last - average) * 0.05;
+        }
+        // a query still in flight can't be restarted, drop its result
+        pending[next] = false;
+    }
+};
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+// no Xlib through eglplatform.h, its macros (None, Status, Always...) clash with everything
+#ifndef EGL_NO_X11
+#define EGL_NO_X11
+#endif
+#ifndef MESA_EGL_NO_X11_HEADERS
+#define MESA_EGL_NO_X11_HEADERS
+#endif
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+// OpenGL 3.3 core context without a window or display, for benchmarks on machines without a GPU
+// (Mesa llvmpipe) or without X. Uses the surfaceless platform of Mesa when it is there and the
+// default display otherwise. The context renders into a pbuffer of the given size, which stands in
+// for the window as framebuffer 0.
+class HeadlessContext
+{
+public:
+    HeadlessContext() = default;
+    HeadlessContext(const HeadlessContext&) = delete;
+    HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+    ~HeadlessContext()
+    {
+        if (display == EGL_NO_DISPLAY)
+            return;
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (context != EGL_NO_CONTEXT)
+            eglDestroyContext(display, context);
+        if (surface != EGL_NO_SURFACE)
+            eglDestroySurface(display, surface);
+        eglTerminate(display);
+    }
+
+    // creates the context and makes it current, false with an error printed if that fails
+    bool Create(int width, int height)
+    {
+        auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        EGLint major = 0, minor = 0;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+            return fail("no EGL display");
+        if (!eglBindAPI(EGL_OPENGL_API))
+            return fail("EGL can't create desktop OpenGL contexts");
+
+        const EGLint configAttributes[] = {
+                EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+                EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+                EGL_DEPTH_SIZE, 24,
+                EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configs = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &configs) || configs == 0)
+            return fail("no RGBA8 / depth 24 pbuffer config");
+
+        const EGLint surfaceAttributes[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+        surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+        if (surface == EGL_NO_SURFACE)
+            return fail("could not create a pbuffer");
+
+        const EGLint contextAttributes[] = {
+                EGL_CONTEXT_MAJOR_VERSION, 3,
+                EGL_CONTEXT_MINOR_VERSION, 3,
+                EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                EGL_NONE
+        };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+        if (context == EGL_NO_CONTEXT)
+            return fail("could not create an OpenGL 3.3 core context");
+        if (!eglMakeCurrent(display, surface, surface, context))
+            return fail("could not make the context current");
+        // no vsync, frames are timed as fast as they go
+        eglSwapInterval(display, 0);
+        this->width = width;
+        this->height = height;
+        return true;
+    }
+
+    void SwapBuffers()
+    {
+        eglSwapBuffers(display, surface);
+    }
+
+    // for gladLoadGLLoader and ProgramCache::Init
+    static void *GetProcAddress(const char *name)
+    {
+        return (void*)eglGetProcAddress(name);
+    }
+
+    int Width() const
+    {
+        return width;
+    }
+
+    int Height() const
+    {
+        return height;
+    }
+
+private:
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLSurface surface = EGL_NO_SURFACE;
+    EGLContext context = EGL_NO_CONTEXT;
+    int width = 0, height = 0;
+
+    bool fail(const char *reason) const
+    {
+        std::cout << "ERROR::HEADLESS_CONTEXT:: " << reason << " (EGL error 0x" << std::hex << eglGetError()
+                  << std::dec << ")" << std::endl;
+        return false;
+    }
+};
+
+#endif
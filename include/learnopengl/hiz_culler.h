@@ -0,0 +1,217 @@
+#ifndef HIZ_CULLER_H
+#define HIZ_CULLER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/bounds.h>
+#include <learnopengl/gpu_memory.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+// Occlusion culling against a hierarchical depth buffer (Hi-Z) on the CPU.
+//
+// At the end of a frame Capture reads the depth buffer into one of two pixel buffers without
+// waiting for the GPU. Update, called before the next frame is submitted, maps the other buffer
+// (filled a frame earlier, so the copy is long done) and reduces it into a pyramid where each
+// texel holds the farthest depth of the area it covers. Occluded projects a world box with the
+// view-projection the depth was rendered with and compares its nearest depth to the pyramid
+// texels under its screen rectangle; if the box is behind all of them it cannot be visible.
+//
+// The depth is two frames old. When the camera moves quickly an object coming out from behind
+// an occluder can show up a frame or two late. Only glReadPixels and buffer mapping are needed,
+// so it also runs on software rasterizers like llvmpipe.
+class HiZCuller
+{
+public:
+    // added to the farthest occluder depth before comparing, against flicker on nearly coplanar surfaces
+    float DepthBias = 0.00005f;
+
+    // reads the depth of the current read framebuffer. viewProjection is what the frame was drawn with.
+    void Capture(const glm::mat4 &viewProjection, int width, int height)
+    {
+        if (width <= 0 || height <= 0)
+            return;
+        if (!supportChecked)
+        {
+            // depth of a multisampled default framebuffer can't be read back directly
+            GLint sampleBuffers = 0;
+            glGetIntegerv(GL_SAMPLE_BUFFERS, &sampleBuffers);
+            supported = sampleBuffers == 0;
+            supportChecked = true;
+            if (!supported)
+                std::cout << "ERROR::HIZ:: multisampled framebuffer, occlusion culling disabled" << std::endl;
+        }
+        if (!supported)
+            return;
+
+        Readback &readback = readbacks[next];
+        if (readback.buffer == 0)
+            glGenBuffers(1, &readback.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        if (readback.width != width || readback.height != height)
+        {
+            glBufferData(GL_PIXEL_PACK_BUFFER, (size_t)width * height * sizeof(float), nullptr, GL_STREAM_READ);
+            GpuMemory::Instance().TrackBuffer(readback.buffer, (size_t)width * height * sizeof(float),
+                                              GpuMemory::DynamicBuffer, "Hi-Z depth readback");
+            readback.width = width;
+            readback.height = height;
+        }
+        glReadPixels(0, 0, width, height, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        readback.viewProjection = viewProjection;
+        readback.pending = true;
+        next ^= 1;
+    }
+
+    // builds the pyramid from the oldest capture, if there is one
+    void Update()
+    {
+        Readback &readback = readbacks[next];
+        if (!readback.pending)
+            return;
+        readback.pending = false;
+
+        size_t bytes = (size_t)readback.width * readback.height * sizeof(float);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        const float *depth = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+        if (depth)
+        {
+            build(depth, readback.width, readback.height);
+            viewProjection = readback.viewProjection;
+            ready = true;
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    // drops the pyramid, e.g. after a camera cut
+    void Reset()
+    {
+        ready = false;
+        readbacks[0].pending = readbacks[1].pending = false;
+    }
+
+    bool Ready() const
+    {
+        return ready;
+    }
+
+    // true if the box is certainly hidden behind what was in the depth buffer
+    bool Occluded(const AABB &box) const
+    {
+        if (!ready || box.Empty())
+            return false;
+
+        glm::vec2 low(1.0f), high(-1.0f);
+        float nearest = 1.0f;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            glm::vec4 clip = viewProjection * glm::vec4(corner & 1 ? box.max.x : box.min.x,
+                                                        corner & 2 ? box.max.y : box.min.y,
+                                                        corner & 4 ? box.max.z : box.min.z, 1.0f);
+            // a corner behind the camera, the box straddles the near plane
+            if (clip.w <= 0.0001f)
+                return false;
+            glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            low = glm::vec2(std::min(low.x, ndc.x), std::min(low.y, ndc.y));
+            high = glm::vec2(std::max(high.x, ndc.x), std::max(high.y, ndc.y));
+            nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+        }
+        if (high.x < -1.0f || high.y < -1.0f || low.x > 1.0f || low.y > 1.0f)
+            return false;  // off screen, that is the frustum test's business
+        if (nearest <= 0.0f)
+            return false;
+
+        int x0 = texel(low.x, depthWidth), x1 = texel(high.x, depthWidth);
+        int y0 = texel(low.y, depthHeight), y1 = texel(high.y, depthHeight);
+
+        // coarsest level first where the rectangle covers at most 2x2 texels
+        unsigned int level = 0;
+        while (level + 1 < levels.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+            level++;
+
+        const Level &pyramid = levels[level];
+        float farthest = 0.0f;
+        for (int y = y0 >> level; y <= std::min(y1 >> level, pyramid.height - 1); y++)
+            for (int x = x0 >> level; x <= std::min(x1 >> level, pyramid.width - 1); x++)
+                farthest = std::max(farthest, pyramid.depth[y * pyramid.width + x]);
+        return nearest > farthest + DepthBias;
+    }
+
+private:
+    struct Readback {
+        unsigned int buffer = 0;
+        int width = 0;
+        int height = 0;
+        glm::mat4 viewProjection = glm::mat4(1.0f);
+        bool pending = false;
+    };
+
+    // one pyramid level, farthest depth per texel, rows bottom to top like the framebuffer
+    struct Level {
+        int width = 0;
+        int height = 0;
+        std::vector<float> depth;
+    };
+
+    Readback readbacks[2];
+    unsigned int next = 0;
+    std::vector<Level> levels;
+    int depthWidth = 0, depthHeight = 0;  // framebuffer size the pyramid was built from
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    bool ready = false;
+    bool supportChecked = false;
+    bool supported = true;
+
+    // level 0 is already half the framebuffer size, every further level halves again down to 1x1.
+    // odd sizes round up and the last row/column is folded into the texel next to it.
+    void build(const float *depth, int width, int height)
+    {
+        int levelWidth = std::max(1, (width + 1) / 2), levelHeight = std::max(1, (height + 1) / 2);
+        std::vector<Level> built;
+        built.reserve(levels.size());
+        built.push_back(downsample(depth, width, height, levelWidth, levelHeight));
+        while (levelWidth > 1 || levelHeight > 1)
+        {
+            const Level &previous = built.back();
+            levelWidth = std::max(1, (levelWidth + 1) / 2);
+            levelHeight = std::max(1, (levelHeight + 1) / 2);
+            built.push_back(downsample(previous.depth.data(), previous.width, previous.height, levelWidth, levelHeight));
+        }
+        levels.swap(built);
+        depthWidth = width;
+        depthHeight = height;
+    }
+
+    static Level downsample(const float *source, int sourceWidth, int sourceHeight, int width, int height)
+    {
+        Level level;
+        level.width = width;
+        level.height = height;
+        level.depth.resize((size_t)width * height);
+        for (int y = 0; y < height; y++)
+        {
+            const float *row0 = source + (size_t)std::min(2 * y, sourceHeight - 1) * sourceWidth;
+            const float *row1 = source + (size_t)std::min(2 * y + 1, sourceHeight - 1) * sourceWidth;
+            for (int x = 0; x < width; x++)
+            {
+                int left = std::min(2 * x, sourceWidth - 1), right = std::min(2 * x + 1, sourceWidth - 1);
+                level.depth[(size_t)y * width + x] = std::max(std::max(row0[left], row0[right]), std::max(row1[left], row1[right]));
+            }
+        }
+        return level;
+    }
+
+    // normalized device coordinate to the level 0 texel holding the framebuffer pixel there
+    static int texel(float ndc, int framebufferSize)
+    {
+        int pixel = (int)((std::min(std::max(ndc, -1.0f), 1.0f) * 0.5f + 0.5f) * framebufferSize);
+        return std::min(pixel, framebufferSize - 1) / 2;
+    }
+};
+
+#endif
@@ -0,0 +1,381 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/gl_state.h>
+#include <learnopengl/gpu_memory.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// a point light for clustered shading, the PointLight of model_lighting.fs plus the distance it
+// reaches. The light is faded out towards radius so it can be left out of clusters beyond it.
+struct ClusterLight {
+    glm::vec3 position = glm::vec3(0.0f);
+    float radius = 1.0f;
+
+    glm::vec3 ambient = glm::vec3(0.0f);
+    glm::vec3 diffuse = glm::vec3(0.0f);
+    glm::vec3 specular = glm::vec3(0.0f);
+
+    float constant = 1.0f;
+    float linear = 0.0f;
+    float quadratic = 0.0f;
+};
+
+// std140 layout of the ClusterBlock uniform block in model_lighting.fs
+struct ClusterBlockData {
+    glm::ivec4 dimensions;   // clusters along x, y and z, light count
+    glm::vec2 viewportSize;
+    float sliceScale;        // depth slice = log(view depth) * sliceScale + sliceBias
+    float sliceBias;
+    float nearPlane;
+    float farPlane;
+    float pad[2];
+};
+static_assert(sizeof(ClusterBlockData) == 48, "std140 ClusterBlock is 48 bytes");
+
+// Clustered light assignment on the CPU. The view frustum is split into GridX x GridY screen tiles
+// and GridZ depth slices (exponential, so clusters stay roughly cube shaped), and every light is
+// added to the clusters its bounding sphere can touch. The fragment shader finds its cluster from
+// gl_FragCoord and only loops over the lights listed there.
+//
+// Build works on structure-of-arrays copies of the lights, the per-light loops are plain arithmetic
+// without branches so the compiler can vectorize them. Each light gets a conservative cluster range
+// from the screen rectangle and depth range of its sphere, and inside that range only the clusters
+// whose view space box the sphere touches. The result is uploaded into three buffer textures:
+// light data (4 texels per light), per-cluster (first index, count) and the index list.
+class LightClusters
+{
+public:
+    static const int GridX = 16;
+    static const int GridY = 9;
+    static const int GridZ = 24;
+    static const int ClusterCount = GridX * GridY * GridZ;
+
+    // texture units of the buffer textures, above anything a material uses
+    static const unsigned int LightDataUnit = 13;
+    static const unsigned int GridUnit = 14;
+    static const unsigned int IndexUnit = 15;
+
+    struct Stats {
+        unsigned int lights = 0;
+        unsigned int visibleLights = 0;       // touching at least one cluster
+        unsigned int indices = 0;             // light references in all clusters together
+        unsigned int occupiedClusters = 0;
+        unsigned int maxPerCluster = 0;
+        double buildMicroseconds = 0.0;
+    };
+
+    LightClusters() = default;
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    ~LightClusters()
+    {
+        Release();
+    }
+
+    // deletes the buffers and their textures while the context is still there, Upload creates them again
+    void Release()
+    {
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            if (textures[i] != 0)
+                GLState::Instance().DeleteTexture(textures[i]);
+            if (buffers[i] != 0)
+            {
+                glDeleteBuffers(1, &buffers[i]);
+                GpuMemory::Instance().Release(GpuMemory::Buffer, buffers[i]);
+            }
+            textures[i] = buffers[i] = 0;
+        }
+    }
+
+    // distance at which constant/linear/quadratic attenuation brings a light of the given
+    // brightness (largest color component) below threshold
+    static float Range(float constant, float linear, float quadratic, float brightness, float threshold = 1.0f / 256.0f)
+    {
+        float c = constant - brightness / threshold;
+        if (c >= 0.0f)
+            return 0.0f;
+        if (quadratic <= 0.0f)
+            return linear > 0.0f ? -c / linear : 1.0e6f;
+        return (-linear + std::sqrt(linear * linear - 4.0f * quadratic * c)) / (2.0f * quadratic);
+    }
+
+    // assigns lights to clusters for a symmetric perspective projection, no GL calls
+    void Build(const glm::mat4 &view, const glm::mat4 &projection, float nearPlane, float farPlane, const std::vector<ClusterLight> &lights)
+    {
+        auto start = std::chrono::steady_clock::now();
+        this->nearPlane = nearPlane;
+        this->farPlane = farPlane;
+        sliceScale = GridZ / std::log(farPlane / nearPlane);
+        sliceBias = -GridZ * std::log(nearPlane) / std::log(farPlane / nearPlane);
+        if (projection[0][0] != boxesScaleX || projection[1][1] != boxesScaleY || nearPlane != boxesNear || farPlane != boxesFar)
+            buildClusterBoxes(projection[0][0], projection[1][1]);
+
+        size_t count = lights.size();
+        worldX.resize(count); worldY.resize(count); worldZ.resize(count); radius.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            worldX[i] = lights[i].position.x;
+            worldY[i] = lights[i].position.y;
+            worldZ[i] = lights[i].position.z;
+            radius[i] = lights[i].radius;
+        }
+
+        // view space x, y and depth (distance along the view direction)
+        viewX.resize(count); viewY.resize(count); depth.resize(count);
+        const glm::mat4 &m = view;
+        for (size_t i = 0; i < count; i++)
+        {
+            viewX[i] = m[0][0] * worldX[i] + m[1][0] * worldY[i] + m[2][0] * worldZ[i] + m[3][0];
+            viewY[i] = m[0][1] * worldX[i] + m[1][1] * worldY[i] + m[2][1] * worldZ[i] + m[3][1];
+            depth[i] = -(m[0][2] * worldX[i] + m[1][2] * worldY[i] + m[2][2] * worldZ[i] + m[3][2]);
+        }
+
+        // cluster range of each light from the screen rectangle and depth range of its view space box.
+        // x / depth of a box is extreme at its corners: the nearest depth where x is negative, the farthest otherwise.
+        for (int axis = 0; axis < 6; axis++)
+            ranges[axis].resize(count);
+        float scaleX = projection[0][0], scaleY = projection[1][1];
+        for (size_t i = 0; i < count; i++)
+        {
+            float r = radius[i];
+            float nearest = std::max(depth[i] - r, nearPlane);
+            float farthest = std::min(depth[i] + r, farPlane);
+            bool inDepth = nearest <= farthest;
+            farthest = std::max(farthest, nearest);
+            float left = viewX[i] - r, right = viewX[i] + r;
+            float bottom = viewY[i] - r, top = viewY[i] + r;
+            float ndcLeft = scaleX * left / (left < 0.0f ? nearest : farthest);
+            float ndcRight = scaleX * right / (right > 0.0f ? nearest : farthest);
+            float ndcBottom = scaleY * bottom / (bottom < 0.0f ? nearest : farthest);
+            float ndcTop = scaleY * top / (top > 0.0f ? nearest : farthest);
+            bool inside = inDepth && ndcLeft <= 1.0f && ndcRight >= -1.0f && ndcBottom <= 1.0f && ndcTop >= -1.0f;
+
+            ranges[0][i] = tile(ndcLeft, GridX);
+            ranges[1][i] = inside ? tile(ndcRight, GridX) : -1;
+            ranges[2][i] = tile(ndcBottom, GridY);
+            ranges[3][i] = tile(ndcTop, GridY);
+            ranges[4][i] = slice(nearest);
+            ranges[5][i] = slice(farthest);
+        }
+
+        // (cluster, light) pairs counted per cluster, prefix sum into (first, count) per cluster, then
+        // a counting sort of the pairs into the index list
+        std::fill(clusterCounts.begin(), clusterCounts.end(), 0u);
+        pairs.clear();
+        stats = Stats();
+        stats.lights = (unsigned int)count;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (ranges[1][i] < 0)
+                continue;
+            stats.visibleLights++;
+            uint32_t light = (uint32_t)i;
+            forEachCluster(i, [this, light](int cluster) {
+                clusterCounts[cluster]++;
+                pairs.push_back(Pair{(uint32_t)cluster, light});
+            });
+        }
+        uint32_t total = 0;
+        for (int cluster = 0; cluster < ClusterCount; cluster++)
+        {
+            grid[2 * cluster] = total;
+            grid[2 * cluster + 1] = clusterCounts[cluster];
+            cursor[cluster] = total;
+            total += clusterCounts[cluster];
+            stats.maxPerCluster = std::max(stats.maxPerCluster, clusterCounts[cluster]);
+            stats.occupiedClusters += clusterCounts[cluster] > 0;
+        }
+        indices.resize(total);
+        for (const Pair &pair : pairs)
+            indices[cursor[pair.cluster]++] = pair.light;
+        stats.indices = total;
+
+        // shading data, 4 texels per light laid out like PointLight in model_lighting.fs
+        lightData.resize(4 * count);
+        for (size_t i = 0; i < count; i++)
+        {
+            const ClusterLight &light = lights[i];
+            lightData[4 * i] = glm::vec4(light.position, light.radius);
+            lightData[4 * i + 1] = glm::vec4(light.ambient, light.constant);
+            lightData[4 * i + 2] = glm::vec4(light.diffuse, light.linear);
+            lightData[4 * i + 3] = glm::vec4(light.specular, light.quadratic);
+        }
+
+        stats.buildMicroseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // sends the result of the last Build to the buffer textures, orphaning last frame's storage
+    void Upload()
+    {
+        if (buffers[0] == 0)
+            create();
+        upload(buffers[0], lightData.data(), lightData.size() * sizeof(glm::vec4));
+        upload(buffers[1], grid.data(), grid.size() * sizeof(uint32_t));
+        upload(buffers[2], indices.data(), indices.size() * sizeof(uint32_t));
+    }
+
+    // binds the buffer textures to LightDataUnit, GridUnit and IndexUnit
+    void Bind() const
+    {
+        GLState &state = GLState::Instance();
+        state.BindTexture(LightDataUnit, GL_TEXTURE_BUFFER, textures[0]);
+        state.BindTexture(GridUnit, GL_TEXTURE_BUFFER, textures[1]);
+        state.BindTexture(IndexUnit, GL_TEXTURE_BUFFER, textures[2]);
+    }
+
+    ClusterBlockData BlockData(int viewportWidth, int viewportHeight) const
+    {
+        ClusterBlockData data = {};
+        data.dimensions = glm::ivec4(GridX, GridY, GridZ, (int)stats.lights);
+        data.viewportSize = glm::vec2((float)viewportWidth, (float)viewportHeight);
+        data.sliceScale = sliceScale;
+        data.sliceBias = sliceBias;
+        data.nearPlane = nearPlane;
+        data.farPlane = farPlane;
+        return data;
+    }
+
+    const Stats &LastStats() const
+    {
+        return stats;
+    }
+
+private:
+    float nearPlane = 0.1f, farPlane = 100.0f;
+    float sliceScale = 0.0f, sliceBias = 0.0f;
+
+    // structure of arrays, one entry per light
+    std::vector<float> worldX, worldY, worldZ, radius;
+    std::vector<float> viewX, viewY, depth;
+    std::vector<int> ranges[6];  // first/last tile x, tile y, slice; last tile x is -1 for lights outside
+
+    // view space bounds of every cluster, for the projection they were built for
+    struct Box {
+        glm::vec3 min, max;
+    };
+    std::vector<Box> clusterBoxes = std::vector<Box>(ClusterCount);
+    float boxesScaleX = 0.0f, boxesScaleY = 0.0f, boxesNear = 0.0f, boxesFar = 0.0f;
+
+    struct Pair {
+        uint32_t cluster, light;
+    };
+    std::vector<Pair> pairs;
+    std::vector<uint32_t> clusterCounts = std::vector<uint32_t>(ClusterCount);
+    std::vector<uint32_t> cursor = std::vector<uint32_t>(ClusterCount);
+    std::vector<uint32_t> grid = std::vector<uint32_t>(2 * ClusterCount);
+    std::vector<uint32_t> indices;
+    std::vector<glm::vec4> lightData;
+    Stats stats;
+
+    unsigned int buffers[3] = {0, 0, 0};
+    unsigned int textures[3] = {0, 0, 0};
+
+    static int tile(float ndc, int tiles)
+    {
+        int index = (int)std::floor((ndc * 0.5f + 0.5f) * tiles);
+        return std::min(std::max(index, 0), tiles - 1);
+    }
+
+    int slice(float viewDepth) const
+    {
+        int index = (int)std::floor(std::log(viewDepth) * sliceScale + sliceBias);
+        return std::min(std::max(index, 0), GridZ - 1);
+    }
+
+    // clusters in the range of light that its sphere touches
+    template <typename Function>
+    void forEachCluster(size_t light, Function function) const
+    {
+        glm::vec3 center(viewX[light], viewY[light], -depth[light]);
+        float radiusSquared = radius[light] * radius[light];
+        for (int z = ranges[4][light]; z <= ranges[5][light]; z++)
+            for (int y = ranges[2][light]; y <= ranges[3][light]; y++)
+                for (int x = ranges[0][light]; x <= ranges[1][light]; x++)
+                {
+                    int cluster = (z * GridY + y) * GridX + x;
+                    const Box &box = clusterBoxes[cluster];
+                    float distance = 0.0f;
+                    for (int axis = 0; axis < 3; axis++)
+                    {
+                        float outside = std::max(std::max(box.min[axis] - center[axis], center[axis] - box.max[axis]), 0.0f);
+                        distance += outside * outside;
+                    }
+                    if (distance <= radiusSquared)
+                        function(cluster);
+                }
+    }
+
+    // the box around the eight corners of each cluster, slices split depth exponentially like slice()
+    void buildClusterBoxes(float scaleX, float scaleY)
+    {
+        for (int z = 0; z < GridZ; z++)
+        {
+            float depths[2] = {nearPlane * std::pow(farPlane / nearPlane, (float)z / GridZ),
+                               nearPlane * std::pow(farPlane / nearPlane, (float)(z + 1) / GridZ)};
+            for (int y = 0; y < GridY; y++)
+                for (int x = 0; x < GridX; x++)
+                {
+                    Box &box = clusterBoxes[(z * GridY + y) * GridX + x];
+                    box.min = glm::vec3(FLT_MAX);
+                    box.max = glm::vec3(-FLT_MAX);
+                    for (float viewDepth : depths)
+                        for (int corner = 0; corner < 4; corner++)
+                        {
+                            float ndcX = -1.0f + 2.0f * (x + (corner & 1)) / GridX;
+                            float ndcY = -1.0f + 2.0f * (y + (corner >> 1)) / GridY;
+                            glm::vec3 point(ndcX * viewDepth / scaleX, ndcY * viewDepth / scaleY, -viewDepth);
+                            for (int axis = 0; axis < 3; axis++)
+                            {
+                                box.min[axis] = std::min(box.min[axis], point[axis]);
+                                box.max[axis] = std::max(box.max[axis], point[axis]);
+                            }
+                        }
+                }
+        }
+        boxesScaleX = scaleX;
+        boxesScaleY = scaleY;
+        boxesNear = nearPlane;
+        boxesFar = farPlane;
+    }
+
+    void create()
+    {
+        const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+        glGenBuffers(3, buffers);
+        glGenTextures(3, textures);
+        for (unsigned int i = 0; i < 3; i++)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+            GpuMemory::Instance().TrackBuffer(buffers[i], 16, GpuMemory::DynamicBuffer, "Light clusters");
+            GLState::Instance().BindTexture(LightDataUnit + i, GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // buffer textures with no storage are not allowed everywhere, empty lists keep a few bytes
+    static void upload(unsigned int buffer, const void *data, size_t bytes)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(bytes, 16), nullptr, GL_STREAM_DRAW);
+        GpuMemory::Instance().TrackBuffer(buffer, std::max<size_t>(bytes, 16), GpuMemory::DynamicBuffer, "Light clusters");
+        if (bytes > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+};
+
+#endif
@@ -6,12 +6,21 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <learnopengl/bounds.h>
+#include <learnopengl/gl_state.h>
+#include <learnopengl/gpu_memory.h>
 #include <learnopengl/shader.h>
+#include <learnopengl/shader_variants.h>
 
+#include <algorithm>
+#include <memory>
 #include <string>
 #include <vector>
 using namespace std;
 
+// first attribute location of the per-instance model matrix (a mat4 takes locations 5 to 8)
+const unsigned int INSTANCE_MODEL_LOCATION = 5;
+
 struct Vertex {
     // position
     glm::vec3 Position;
@@ -33,37 +42,245 @@ struct Texture {
     string path;
 };
 
+// where a mesh lives inside the shared buffers of a GeometryArena
+struct ArenaRange {
+    unsigned int firstIndex = 0;
+    unsigned int indexCount = 0;
+    int baseVertex = 0;
+
+    // byte offset of the first index, in the form glDrawElements* expects
+    const void *IndexOffset() const
+    {
+        return (const void*)(firstIndex * sizeof(unsigned int));
+    }
+};
+
+// CPU-side contents of a mesh before it is uploaded. Textures only carry their type and path here.
+// Meshes parsed by Assimp own their vertices and indices. Meshes read from the mesh cache point into
+// the memory-mapped cache file instead, which stays mapped as long as mapping is held, and are
+// uploaded straight from there.
+struct MeshData {
+    vector<Vertex>       vertices;
+    vector<unsigned int> indices;
+    vector<Texture>      textures;
+
+    shared_ptr<const void> mapping;
+    const Vertex         *mappedVertices = nullptr;
+    const unsigned int   *mappedIndices = nullptr;
+    size_t               mappedVertexCount = 0;
+    size_t               mappedIndexCount = 0;
+
+    const Vertex *VertexData() const
+    {
+        return mapping ? mappedVertices : vertices.data();
+    }
+
+    size_t VertexCount() const
+    {
+        return mapping ? mappedVertexCount : vertices.size();
+    }
+
+    const unsigned int *IndexData() const
+    {
+        return mapping ? mappedIndices : indices.data();
+    }
+
+    size_t IndexCount() const
+    {
+        return mapping ? mappedIndexCount : indices.size();
+    }
+};
+
 class Mesh {
 public:
     // mesh Data
-    vector<Vertex>       vertices;
-    vector<unsigned int> indices;
     vector<Texture>      textures;
 
     unsigned int VAO;
     std::string glslIdentifierPrefix;
-    // constructor
-    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    // object space bounds, computed once from the vertices
+    AABB Bounds;
+    BoundingSphere Sphere;
+    // constructor, owner names the asset the mesh belongs to in the GpuMemory book
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, const std::string &owner = "")
+        : Mesh(makeData(std::move(vertices), std::move(indices), std::move(textures)), owner)
+    {
+    }
+
+    // the vertices and indices are uploaded from wherever data keeps them, see MeshData
+    explicit Mesh(MeshData data, const std::string &owner = "")
     {
-        this->vertices = vertices;
-        this->indices = indices;
-        this->textures = textures;
+        textures = std::move(data.textures);
+        geometry = std::move(data);
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        setupMesh(owner);
+        computeBounds();
+        for (const Texture &texture : this->textures)
+        {
+            hasSpecularMap = hasSpecularMap || texture.type == "texture_specular";
+            hasNormalMap = hasNormalMap || texture.type == "texture_normal";
+        }
+    }
+
+    // base with the texture features of this mesh filled in, to pick the shader variant it is drawn with
+    ShaderFeatures Features(ShaderFeatures base) const
+    {
+        base.specularMap = hasSpecularMap;
+        base.normalMap = hasNormalMap;
+        return base;
     }
 
     // render the mesh
     void Draw(Shader &shader)
     {
-        // bind appropriate textures
+        BindTextures(shader);
+
+        // draw mesh. The VAO stays bound, GLState drops the bind if the next mesh uses the same one.
+        GLState::Instance().BindVertexArray(VAO);
+        DrawGeometry(0);
+    }
+
+    // render instanceCount copies of the mesh in one draw call, with per-instance model matrices
+    // taken from the buffer attached by SetInstanceBuffer (or the arena's instance buffer)
+    void DrawInstanced(Shader &shader, unsigned int instanceCount)
+    {
+        BindTextures(shader);
+
+        GLState::Instance().BindVertexArray(VAO);
+        DrawGeometry(instanceCount);
+    }
+
+    // only the draw call, for callers that track bound state themselves (see RenderQueue):
+    // VAO and textures have to be bound already. instanceCount 0 draws without instancing.
+    void DrawGeometry(unsigned int instanceCount) const
+    {
+        if (instanceCount == 0)
+            glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, range.IndexOffset(), range.baseVertex);
+        else
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.indexCount, GL_UNSIGNED_INT, range.IndexOffset(), instanceCount, range.baseVertex);
+    }
+
+    // bind the textures to consecutive units and point the samplers at them
+    void BindTextures(Shader &shader)
+    {
+        const vector<Shader::Uniform> &samplers = samplerUniforms(shader);
+        for(unsigned int i = 0; i < textures.size(); i++)
+        {
+            // set the sampler to the correct texture unit
+            shader.setInt(samplers[i], i);
+            // and bind the texture there, the unit is only activated if the binding changes
+            GLState::Instance().BindTexture(i, GL_TEXTURE_2D, textures[i].id);
+        }
+    }
+
+    // feeds the model matrices in instanceVBO to attribute locations 5-8 (one mat4, one per instance)
+    void SetInstanceBuffer(unsigned int instanceVBO)
+    {
+        GLState::Instance().BindVertexArray(VAO);
+        EnableInstanceAttributes(instanceVBO);
+        GLState::Instance().BindVertexArray(0);
+    }
+
+    // vertices and indices the buffers were filled from, kept until the mesh is moved into an arena
+    const MeshData &Geometry() const
+    {
+        return geometry;
+    }
+
+    // from now on the mesh is drawn from the shared arena buffers, its own buffers and the
+    // CPU-side geometry are dropped
+    void UseArena(unsigned int arenaVAO, ArenaRange range)
+    {
+        deleteBuffers();
+        geometry = MeshData();
+        VAO = arenaVAO;
+        VBO = EBO = 0;
+        this->range = range;
+        inArena = true;
+    }
+
+    bool InArena() const
+    {
+        return inArena;
+    }
+
+    // deletes the buffers and VAO of the mesh, the arena ones stay. Textures belong to the Model.
+    void Release()
+    {
+        if (!inArena && VAO != 0)
+            deleteBuffers();
+        VAO = 0;
+        geometry = MeshData();
+    }
+
+    // vertex attribute layout of Vertex, for the VAO and GL_ARRAY_BUFFER that are currently bound
+    static void EnableVertexAttributes()
+    {
+        // set the vertex attribute pointers
+        // vertex Positions
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
+        // vertex normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+        // vertex texture coords
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+        // vertex tangent
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
+        // vertex bitangent
+        glEnableVertexAttribArray(4);
+        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+    }
+
+    // per-instance model matrix from instanceVBO on locations 5-8, for the VAO that is currently bound
+    static void EnableInstanceAttributes(unsigned int instanceVBO)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        for (unsigned int column = 0; column < 4; column++)
+        {
+            glEnableVertexAttribArray(INSTANCE_MODEL_LOCATION + column);
+            glVertexAttribPointer(INSTANCE_MODEL_LOCATION + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(INSTANCE_MODEL_LOCATION + column, 1);
+        }
+    }
+
+    void SetShaderTextureNamePrefix(const std::string &prefix)
+    {
+        glslIdentifierPrefix = prefix;
+        samplerCache.clear();
+    }
+
+private:
+    // render data
+    MeshData geometry;
+    unsigned int VBO, EBO;
+    bool inArena = false;
+    bool hasSpecularMap = false;
+    bool hasNormalMap = false;
+    // indices to draw, the whole index buffer unless the mesh was moved into an arena
+    ArenaRange range;
+
+    // sampler uniform of every texture, per shader program the mesh was drawn with (by Shader::Serial)
+    vector<pair<uint64_t, vector<Shader::Uniform>>> samplerCache;
+
+    // resolves the sampler names (prefix + texture_diffuseN etc.) for a program the first time
+    // the mesh is drawn with it, later draws only look up the cached handles.
+    const vector<Shader::Uniform> &samplerUniforms(const Shader &shader)
+    {
+        for (const auto &cached : samplerCache)
+            if (cached.first == shader.Serial())
+                return cached.second;
+
         unsigned int diffuseNr  = 1;
         unsigned int specularNr = 1;
         unsigned int normalNr   = 1;
         unsigned int heightNr   = 1;
+        vector<Shader::Uniform> samplers;
         for(unsigned int i = 0; i < textures.size(); i++)
         {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
             // retrieve texture number (the N in diffuse_textureN)
             string number;
             string name = textures[i].type;
@@ -75,65 +292,69 @@ public:
                 number = std::to_string(normalNr++); // transfer unsigned int to stream
             else if(name == "texture_height")
                 number = std::to_string(heightNr++); // transfer unsigned int to stream
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (glslIdentifierPrefix + name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+            samplers.push_back(shader.GetUniform(glslIdentifierPrefix + name + number));
         }
+        samplerCache.emplace_back(shader.Serial(), std::move(samplers));
+        return samplerCache.back().second;
+    }
 
+    static MeshData makeData(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+    {
+        MeshData data;
+        data.vertices = std::move(vertices);
+        data.indices = std::move(indices);
+        data.textures = std::move(textures);
+        return data;
+    }
 
-
-        // draw mesh
-        glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
-
-        // always good practice to set everything back to defaults once configured.
-        glActiveTexture(GL_TEXTURE0);
+    void computeBounds()
+    {
+        const Vertex *vertices = geometry.VertexData();
+        size_t count = geometry.VertexCount();
+        for (size_t i = 0; i < count; i++)
+            Bounds.Expand(vertices[i].Position);
+        Sphere.center = Bounds.Center();
+        for (size_t i = 0; i < count; i++)
+            Sphere.radius = std::max(Sphere.radius, glm::length(vertices[i].Position - Sphere.center));
     }
 
-private:
-    // render data
-    unsigned int VBO, EBO;
+    void deleteBuffers()
+    {
+        GLState::Instance().DeleteVertexArray(VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        GpuMemory::Instance().Release(GpuMemory::Buffer, VBO);
+        GpuMemory::Instance().Release(GpuMemory::Buffer, EBO);
+        VBO = EBO = 0;
+    }
 
     // initializes all the buffer objects/arrays
-    void setupMesh()
+    void setupMesh(const std::string &owner)
     {
         // create buffers/arrays
         glGenVertexArrays(1, &VAO);
         glGenBuffers(1, &VBO);
         glGenBuffers(1, &EBO);
 
-        glBindVertexArray(VAO);
+        GLState::Instance().BindVertexArray(VAO);
         // load data into vertex buffers
         glBindBuffer(GL_ARRAY_BUFFER, VBO);
         // A great thing about structs is that their memory layout is sequential for all its items.
         // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
         // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+        size_t vertexBytes = geometry.VertexCount() * sizeof(Vertex);
+        size_t indexBytes = geometry.IndexCount() * sizeof(unsigned int);
+        glBufferData(GL_ARRAY_BUFFER, vertexBytes, geometry.VertexData(), GL_STATIC_DRAW);
 
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, geometry.IndexData(), GL_STATIC_DRAW);
+        GpuMemory::Instance().TrackBuffer(VBO, vertexBytes, GpuMemory::Geometry, owner + " vertices");
+        GpuMemory::Instance().TrackBuffer(EBO, indexBytes, GpuMemory::Geometry, owner + " indices");
 
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
+        EnableVertexAttributes();
 
-        glBindVertexArray(0);
+        GLState::Instance().BindVertexArray(0);
+        range.indexCount = (unsigned int)geometry.IndexCount();
     }
 };
 #endif
\ No newline at end of file
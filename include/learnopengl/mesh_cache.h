@@ -0,0 +1,257 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <learnopengl/mesh.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <iostream>
+using namespace std;
+
+// Binary cache of already-flattened model data, so a warm start can skip Assimp completely.
+// Every source model gets one file in the cache directory. The file is only used if the source
+// path, its size and modification time, the post-process flags and the Vertex layout all match.
+//
+// File layout (all integers little endian, every block padded to 4 bytes):
+//   Header | source path | per mesh: MeshHeader, texture records, vertices, indices
+class MeshCache
+{
+public:
+    static const uint32_t Version = 1;
+
+    // set RG_NO_MESH_CACHE in the environment to always go through Assimp (cold start timings)
+    static bool Enabled()
+    {
+        static bool enabled = getenv("RG_NO_MESH_CACHE") == nullptr;
+        return enabled;
+    }
+
+    // memory-maps the cache file for the given model and fills meshes with its contents. The vertices
+    // and indices are not copied, the meshes point into the mapping, which is unmapped when the last
+    // of them lets go of it (see MeshData). Returns false if there is no cache entry or if it is
+    // stale or damaged, in which case meshes is left empty.
+    static bool Load(const string &path, unsigned int flags, vector<MeshData> &meshes)
+    {
+        struct stat source;
+        if (!Enabled() || stat(path.c_str(), &source) != 0)
+            return false;
+
+        int fd = open(cachePath(path, flags).c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        struct stat cache;
+        if (fstat(fd, &cache) != 0 || cache.st_size < (off_t)sizeof(Header))
+        {
+            close(fd);
+            return false;
+        }
+        size_t size = (size_t)cache.st_size;
+        void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (mapping == MAP_FAILED)
+            return false;
+
+        shared_ptr<const void> file(mapping, [size](const void *data) { munmap((void*)data, size); });
+        Reader in{(const char*)mapping, (const char*)mapping + size};
+        bool ok = read(in, path, flags, source, file, meshes);
+        if (!ok)
+            meshes.clear();
+        return ok;
+    }
+
+    // writes meshes to the cache. The file is written next to its final name and renamed into place,
+    // so a crash in the middle never leaves a truncated entry behind.
+    static void Store(const string &path, unsigned int flags, const vector<MeshData> &meshes)
+    {
+        struct stat source;
+        if (!Enabled() || stat(path.c_str(), &source) != 0)
+            return;
+        mkdir(Directory().c_str(), 0755);
+
+        string target = cachePath(path, flags);
+        string temporary = target + ".tmp";
+        FILE *out = fopen(temporary.c_str(), "wb");
+        if (!out)
+        {
+            cout << "ERROR::MESH_CACHE:: could not write " << temporary << endl;
+            return;
+        }
+
+        Header header;
+        memcpy(header.magic, magic(), sizeof(header.magic));
+        header.version = Version;
+        header.vertexSize = sizeof(Vertex);
+        header.flags = flags;
+        header.meshCount = (uint32_t)meshes.size();
+        header.sourceSize = (uint64_t)source.st_size;
+        header.sourceMtime = (int64_t)source.st_mtime;
+        header.pathLength = (uint32_t)path.size();
+        fwrite(&header, sizeof(header), 1, out);
+        writeString(out, path);
+
+        for (const MeshData &mesh : meshes)
+        {
+            MeshHeader meshHeader;
+            meshHeader.vertexCount = (uint32_t)mesh.vertices.size();
+            meshHeader.indexCount = (uint32_t)mesh.indices.size();
+            meshHeader.textureCount = (uint32_t)mesh.textures.size();
+            fwrite(&meshHeader, sizeof(meshHeader), 1, out);
+            for (const Texture &texture : mesh.textures)
+            {
+                uint32_t lengths[2] = {(uint32_t)texture.type.size(), (uint32_t)texture.path.size()};
+                fwrite(lengths, sizeof(lengths), 1, out);
+                writeString(out, texture.type);
+                writeString(out, texture.path);
+            }
+            fwrite(mesh.vertices.data(), sizeof(Vertex), mesh.vertices.size(), out);
+            fwrite(mesh.indices.data(), sizeof(unsigned int), mesh.indices.size(), out);
+        }
+
+        bool ok = ferror(out) == 0;
+        ok = fclose(out) == 0 && ok;
+        if (ok && rename(temporary.c_str(), target.c_str()) == 0)
+            return;
+        cout << "ERROR::MESH_CACHE:: could not write " << target << endl;
+        remove(temporary.c_str());
+    }
+
+    static string Directory()
+    {
+        return "resources/cache";
+    }
+
+private:
+    static const char *magic()
+    {
+        return "RGMESH\0\0";
+    }
+
+    struct Header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t vertexSize;
+        uint32_t flags;
+        uint32_t meshCount;
+        uint64_t sourceSize;
+        int64_t  sourceMtime;
+        uint32_t pathLength;
+        uint32_t reserved = 0;
+    };
+
+    struct MeshHeader {
+        uint32_t vertexCount;
+        uint32_t indexCount;
+        uint32_t textureCount;
+        uint32_t reserved = 0;
+    };
+
+    struct Reader {
+        const char *cursor;
+        const char *end;
+
+        size_t left() const
+        {
+            return (size_t)(end - cursor);
+        }
+
+        const void *take(size_t bytes)
+        {
+            if (left() < bytes)
+                return nullptr;
+            const char *data = cursor;
+            cursor += bytes;
+            return data;
+        }
+    };
+
+    static bool read(Reader &in, const string &path, unsigned int flags, const struct stat &source,
+                     const shared_ptr<const void> &file, vector<MeshData> &meshes)
+    {
+        const Header *header = (const Header*)in.take(sizeof(Header));
+        if (!header || memcmp(header->magic, magic(), sizeof(header->magic)) != 0 || header->version != Version
+            || header->vertexSize != sizeof(Vertex) || header->flags != flags
+            || header->sourceSize != (uint64_t)source.st_size || header->sourceMtime != (int64_t)source.st_mtime)
+            return false;
+        string cachedPath;
+        if (!readString(in, header->pathLength, cachedPath) || cachedPath != path)
+            return false;
+
+        // the counts come from the file, a damaged one must not make us allocate more than it can hold
+        if (header->meshCount > in.left() / sizeof(MeshHeader))
+            return false;
+        meshes.resize(header->meshCount);
+        for (MeshData &mesh : meshes)
+        {
+            const MeshHeader *meshHeader = (const MeshHeader*)in.take(sizeof(MeshHeader));
+            if (!meshHeader || meshHeader->textureCount > in.left() / (2 * sizeof(uint32_t)))
+                return false;
+            mesh.textures.resize(meshHeader->textureCount);
+            for (Texture &texture : mesh.textures)
+            {
+                const uint32_t *lengths = (const uint32_t*)in.take(2 * sizeof(uint32_t));
+                if (!lengths || !readString(in, lengths[0], texture.type) || !readString(in, lengths[1], texture.path))
+                    return false;
+                texture.id = 0;
+            }
+            const Vertex *vertices = (const Vertex*)in.take((size_t)meshHeader->vertexCount * sizeof(Vertex));
+            const unsigned int *indices = (const unsigned int*)in.take((size_t)meshHeader->indexCount * sizeof(unsigned int));
+            if (!vertices || !indices)
+                return false;
+            mesh.mapping = file;
+            mesh.mappedVertices = vertices;
+            mesh.mappedVertexCount = meshHeader->vertexCount;
+            mesh.mappedIndices = indices;
+            mesh.mappedIndexCount = meshHeader->indexCount;
+        }
+        return in.cursor == in.end;
+    }
+
+    static bool readString(Reader &in, uint32_t length, string &value)
+    {
+        const char *data = (const char*)in.take(padded(length));
+        if (!data)
+            return false;
+        value.assign(data, length);
+        return true;
+    }
+
+    static void writeString(FILE *out, const string &value)
+    {
+        static const char zeros[4] = {0, 0, 0, 0};
+        fwrite(value.data(), 1, value.size(), out);
+        fwrite(zeros, 1, padded(value.size()) - value.size(), out);
+    }
+
+    static size_t padded(size_t length)
+    {
+        return (length + 3) & ~(size_t)3;
+    }
+
+    // one file per (model, post-process flags) pair, named after an FNV-1a hash of both
+    static string cachePath(const string &path, unsigned int flags)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (char c : path)
+        {
+            hash ^= (unsigned char)c;
+            hash *= 1099511628211ull;
+        }
+        hash ^= flags;
+        hash *= 1099511628211ull;
+
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.mesh", (unsigned long long)hash);
+        return Directory() + '/' + name;
+    }
+};
+
+#endif
@@ -10,9 +10,15 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
+#include <learnopengl/geometry_arena.h>
 #include <learnopengl/mesh.h>
+#include <learnopengl/mesh_cache.h>
 #include <learnopengl/shader.h>
+#include <learnopengl/texture_registry.h>
+#include <learnopengl/trace_recorder.h>
 
+#include <algorithm>
+#include <chrono>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -23,23 +29,39 @@ using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
 
+// CPU-side result of parsing a model file. Model::Parse fills it without touching OpenGL,
+// so it can run on a worker thread; Model::Upload turns it into meshes and textures on the GL thread.
+struct ModelData {
+    string path;
+    string directory;
+    vector<MeshData> meshes;
+    bool loaded = false;
+    bool cached = false;
+    double parseMs = 0.0;
+};
 
 
 class Model
 {
 public:
     // model data
-    vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
     vector<Mesh>    meshes;
     string directory;
     bool gammaCorrection;
+    // object space bounds of all meshes together
+    AABB Bounds;
+    BoundingSphere Sphere;
 
     // constructor, expects a filepath to a 3D model.
     Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
     {
-        loadModel(path);
+        ModelData data = Parse(path);
+        Upload(data);
     }
 
+    // empty model, filled in later through Upload (see ModelLoader)
+    Model() : gammaCorrection(false) {}
+
     // draws the model, and thus all its meshes
     void Draw(Shader &shader)
     {
@@ -47,33 +69,139 @@ public:
             meshes[i].Draw(shader);
     }
 
+    // draws one copy of the model per matrix with a single instanced draw call per mesh.
+    // the shader has to read the model matrix from the instance attribute, see INSTANCED in model_lighting.vs
+    void DrawInstanced(Shader &shader, const vector<glm::mat4> &instances)
+    {
+        if (instances.empty())
+            return;
+        UploadInstances(instances);
+        for (Mesh &mesh : meshes)
+            mesh.DrawInstanced(shader, (unsigned int)instances.size());
+    }
+
+    // fills the buffer the meshes read their per-instance model matrices from
+    void UploadInstances(const vector<glm::mat4> &instances)
+    {
+        if (arena)
+        {
+            arena->UploadInstances(instances);
+            return;
+        }
+        if (instanceVBO == 0)
+        {
+            glGenBuffers(1, &instanceVBO);
+            for (Mesh &mesh : meshes)
+                mesh.SetInstanceBuffer(instanceVBO);
+        }
+        // orphan last frame's matrices so the driver doesn't wait for draws still reading them
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(glm::mat4), instances.data());
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        GpuMemory::Instance().TrackBuffer(instanceVBO, instances.size() * sizeof(glm::mat4), GpuMemory::DynamicBuffer,
+                                          directory + " instances");
+    }
+
+    // deletes the GPU objects of the meshes and gives the textures back to the registry.
+    // the model is empty afterwards. Must be called on the GL thread while the context is alive.
+    void Release()
+    {
+        for (Mesh &mesh : meshes)
+        {
+            mesh.Release();
+            for (const Texture &texture : mesh.textures)
+                TextureRegistry::Instance().Release(texture.id);
+        }
+        meshes.clear();
+        if (instanceVBO != 0)
+        {
+            glDeleteBuffers(1, &instanceVBO);
+            GpuMemory::Instance().Release(GpuMemory::Buffer, instanceVBO);
+            instanceVBO = 0;
+        }
+        arena = nullptr;
+    }
+
+    // packs all meshes into the shared static buffers of arena, they are switched over once the arena is built.
+    // from then on the model is drawn with the arena bound (see GeometryArena::Bind).
+    void MoveToArena(GeometryArena &arena)
+    {
+        this->arena = &arena;
+        for (Mesh &mesh : meshes)
+            arena.Add(mesh);
+    }
+
     void SetShaderTextureNamePrefix(std::string prefix) {
         for (Mesh& mesh: meshes) {
-            mesh.glslIdentifierPrefix = prefix;
+            mesh.SetShaderTextureNamePrefix(prefix);
         }
     }
-private:
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const &path)
+
+    // reads a model with supported ASSIMP extensions from file.
+    // the flattened meshes are kept in the mesh cache, so the next start can skip ASSIMP.
+    // makes no OpenGL calls and is safe to call from any thread.
+    static ModelData Parse(string const &path)
     {
-        // read file via ASSIMP
-        Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-        // check for errors
-        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+        TRACE_SCOPE("Model::Parse", path);
+        auto start = chrono::steady_clock::now();
+        ModelData data;
+        data.path = path;
+        // retrieve the directory path of the filepath
+        data.directory = path.substr(0, path.find_last_of('/'));
+
+        const unsigned int flags = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
+        data.cached = MeshCache::Load(path, flags, data.meshes);
+        if (!data.cached)
         {
-            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
+            // read file via ASSIMP
+            Assimp::Importer importer;
+            const aiScene* scene = importer.ReadFile(path, flags);
+            // check for errors
+            if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+            {
+                cout << string("ERROR::ASSIMP:: ") + importer.GetErrorString() + "\n" << flush;
+                return data;
+            }
+            // process ASSIMP's root node recursively
+            processNode(scene->mRootNode, scene, data.meshes);
+            MeshCache::Store(path, flags, data.meshes);
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
 
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
+        data.loaded = true;
+        data.parseMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        return data;
     }
 
+    // uploads parsed model data into meshes and requests its textures. Must be called on the GL thread.
+    void Upload(ModelData &data)
+    {
+        if (!data.loaded)
+            return;
+        TRACE_SCOPE("Model::Upload", data.path);
+        auto start = chrono::steady_clock::now();
+        directory = data.directory;
+        for (MeshData &mesh : data.meshes)
+            meshes.push_back(createMesh(mesh, data.path));
+        for (const Mesh &mesh : meshes)
+            Bounds.Expand(mesh.Bounds);
+        Sphere.center = Bounds.Center();
+        for (const Mesh &mesh : meshes)
+            Sphere.radius = std::max(Sphere.radius, glm::length(mesh.Sphere.center - Sphere.center) + mesh.Sphere.radius);
+
+        double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        cout << "MODEL::LOAD " << data.path << (data.cached ? " (mesh cache)" : " (assimp)")
+             << " parse " << data.parseMs << " ms, upload " << ms << " ms" << endl;
+    }
+
+private:
+    // per-instance model matrices for DrawInstanced, created on first use
+    unsigned int instanceVBO = 0;
+    // shared static buffers the meshes were moved into, if any
+    GeometryArena *arena = nullptr;
+
     // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+    static void processNode(aiNode *node, const aiScene *scene, vector<MeshData> &meshData)
     {
         // process each mesh located at the current node
         for(unsigned int i = 0; i < node->mNumMeshes; i++)
@@ -81,22 +209,23 @@ private:
             // the node object only contains indices to index the actual objects in the scene.
             // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
             aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
+            meshData.push_back(processMesh(mesh, scene));
         }
         // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
         for(unsigned int i = 0; i < node->mNumChildren; i++)
         {
-            processNode(node->mChildren[i], scene);
+            processNode(node->mChildren[i], scene, meshData);
         }
 
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    static MeshData processMesh(aiMesh *mesh, const aiScene *scene)
     {
         // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        MeshData data;
+        vector<Vertex> &vertices = data.vertices;
+        vector<unsigned int> &indices = data.indices;
+        vector<Texture> &textures = data.textures;
 
         // walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
@@ -178,82 +307,46 @@ private:
 
 
 
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+        // return the extracted mesh data, textures are only referenced by path at this point
+        return data;
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+    // collects the material textures of a given type. Only type and path are filled in,
+    // the textures themselves are loaded in createMesh.
+    static vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
     {
         vector<Texture> textures;
         for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
         {
             aiString str;
             mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
-            {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
-                {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
-                }
-            }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-            }
+            Texture texture;
+            texture.id = 0;
+            texture.type = typeName;
+            texture.path = str.C_Str();
+            textures.push_back(texture);
         }
         return textures;
     }
+
+    // uploads the textures referenced by the mesh data and the mesh itself.
+    // the texture registry makes sure every image is only loaded once.
+    Mesh createMesh(MeshData &data, const string &path)
+    {
+        for (Texture &texture : data.textures)
+            texture.id = TextureFromFile(texture.path.c_str(), this->directory);
+        return Mesh(std::move(data), path);
+    }
 };
 
 
+// loads a texture from file through the texture registry, so every image is only loaded once per process
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
 {
     string filename = string(path);
     filename = directory + '/' + filename;
+    TRACE_SCOPE("TextureFromFile", filename);
 
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-
-    return textureID;
+    return TextureRegistry::Instance().Acquire(filename);
 }
 #endif
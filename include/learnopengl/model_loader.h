@@ -0,0 +1,66 @@
+#ifndef MODEL_LOADER_H
+#define MODEL_LOADER_H
+
+#include <learnopengl/model.h>
+#include <learnopengl/thread_pool.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <string>
+
+// Loads several models at once: parsing and vertex conversion run on the thread pool, while the
+// finished CPU-side payloads are handed back to the GL thread through a queue and uploaded there.
+// Scene load time becomes roughly that of the slowest model. Material textures are requested
+// during the upload and decoded by the TextureService, if one is running.
+class ModelLoader
+{
+public:
+    explicit ModelLoader(ThreadPool &pool) : pool(pool) {}
+
+    // starts parsing path in the background. model must stay alive until Finish returns.
+    void Load(Model &model, const string &path)
+    {
+        pending++;
+        Model *target = &model;
+        pool.Enqueue([this, target, path]() {
+            ModelData data = Model::Parse(path);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.push(Payload{target, std::move(data)});
+            }
+            ready.notify_one();
+        });
+    }
+
+    // uploads models in the order their payloads arrive and returns once all of them are on the GPU.
+    // must be called on the GL thread.
+    void Finish()
+    {
+        while (pending > 0)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            ready.wait(lock, [this]() { return !finished.empty(); });
+            Payload payload = std::move(finished.front());
+            finished.pop();
+            lock.unlock();
+
+            payload.model->Upload(payload.data);
+            pending--;
+        }
+    }
+
+private:
+    struct Payload {
+        Model *model;
+        ModelData data;
+    };
+
+    ThreadPool &pool;
+    std::queue<Payload> finished;
+    std::mutex mutex;
+    std::condition_variable ready;
+    unsigned int pending = 0;
+};
+
+#endif
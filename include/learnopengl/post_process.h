@@ -0,0 +1,311 @@
+#ifndef POST_PROCESS_H
+#define POST_PROCESS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/gl_state.h>
+#include <learnopengl/gpu_memory.h>
+#include <learnopengl/gpu_timer.h>
+#include <learnopengl/shader.h>
+
+#include <algorithm>
+#include <iostream>
+
+// std140 layout of the BloomBlock uniform block in bloom.glsl
+struct BloomBlockData {
+    float threshold;
+    float knee;
+    float pad[2];
+};
+static_assert(sizeof(BloomBlockData) == 16, "std140 BloomBlock is 16 bytes");
+
+// HDR rendering with bloom. Between BeginScene and Finish the scene is drawn into a floating point
+// target with two color attachments: the lit color and its bright part (BrightColor of the scene
+// shaders, see bloom.glsl). Finish blurs the bright part with a dual filter chain, downsampling
+// from half resolution to the smallest level and upsampling back while adding up the levels,
+// then adds it to the scene, applies exposure and tonemaps into the default framebuffer.
+//
+// The cost stays bounded by the screen size: the chain starts at half resolution in a packed
+// 32 bit float format and has at most MaxLevels levels, and the bright attachment is not written
+// at all while bloom is off.
+class PostProcess
+{
+public:
+    static const int MaxLevels = 6;
+
+    enum Tonemap {
+        Clamp = 0,
+        Reinhard = 1,
+        ACES = 2
+    };
+
+    struct Settings {
+        bool bloom = true;
+        float threshold = 1.0f;    // brightness (largest channel) where bloom starts
+        float knee = 0.25f;        // below threshold over which it fades in
+        float intensity = 0.5f;
+        int levels = 5;            // 1 to MaxLevels, fewer is cheaper and tighter
+        float exposure = 1.0f;
+        int tonemap = ACES;
+    };
+
+    // GPU milliseconds of the passes of Finish, averaged
+    struct Timings {
+        double downsample = 0.0;
+        double upsample = 0.0;
+        double composite = 0.0;
+    };
+
+    Settings settings;
+
+    // the shaders draw with fullscreen.vs: bloom_downsample.fs, bloom_upsample.fs and composite.fs
+    PostProcess(Shader &downsample, Shader &upsample, Shader &composite)
+        : downsampleShader(downsample), upsampleShader(upsample), compositeShader(composite)
+    {
+        downsampleShader.use();
+        downsampleShader.setInt("source", 0);
+        upsampleShader.use();
+        upsampleShader.setInt("source", 0);
+        compositeShader.use();
+        compositeShader.setInt("scene", 0);
+        compositeShader.setInt("bloom", 1);
+        bloomIntensity = compositeShader.GetUniform("bloomIntensity");
+        exposure = compositeShader.GetUniform("exposure");
+        tonemap = compositeShader.GetUniform("tonemap");
+        glGenVertexArrays(1, &fullscreenVAO);
+    }
+
+    PostProcess(const PostProcess&) = delete;
+    PostProcess& operator=(const PostProcess&) = delete;
+
+    ~PostProcess()
+    {
+        Release();
+    }
+
+    // deletes every GL object while the context is still there, for the end of the program
+    void Release()
+    {
+        release();
+        width = height = 0;
+        if (fullscreenVAO != 0)
+            GLState::Instance().DeleteVertexArray(fullscreenVAO);
+        fullscreenVAO = 0;
+    }
+
+    // (re)creates the targets when the size changed, returns false if they are unusable
+    bool Resize(int width, int height)
+    {
+        if (width == this->width && height == this->height)
+            return complete;
+        release();
+        this->width = width;
+        this->height = height;
+        if (width <= 0 || height <= 0)
+            return complete = false;
+
+        glGenFramebuffers(1, &sceneFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+        sceneTextures[0] = createTexture(GL_RGBA16F, width, height, GL_NEAREST);
+        sceneTextures[1] = createTexture(GL_RGBA16F, width, height, GL_LINEAR);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sceneTextures[0], 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, sceneTextures[1], 0);
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+        GpuMemory::Instance().TrackRenderbuffer(depthBuffer, GL_DEPTH_COMPONENT24, width, height, "Post-process scene depth");
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+        // each level half the size of the one before, down to a few pixels
+        levelCount = 0;
+        int levelWidth = width, levelHeight = height;
+        while (levelCount < MaxLevels && levelWidth >= 8 && levelHeight >= 8)
+        {
+            levelWidth = std::max(1, levelWidth / 2);
+            levelHeight = std::max(1, levelHeight / 2);
+            Level &level = levels[levelCount++];
+            level.width = levelWidth;
+            level.height = levelHeight;
+            level.texture = createTexture(GL_R11F_G11F_B10F, levelWidth, levelHeight, GL_LINEAR);
+            glGenFramebuffers(1, &level.framebuffer);
+            glBindFramebuffer(GL_FRAMEBUFFER, level.framebuffer);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, level.texture, 0);
+            complete = complete && glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        }
+        if (!complete)
+            std::cout << "ERROR::POST_PROCESS:: framebuffers " << width << "x" << height << " are not complete" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return complete;
+    }
+
+    // the scene framebuffer, for passes that draw into other targets and come back
+    unsigned int SceneFramebuffer() const
+    {
+        return sceneFramebuffer;
+    }
+
+    // binds and clears the scene target, the bright attachment only while bloom is on
+    void BeginScene(const glm::vec3 &clearColor)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, sceneFramebuffer);
+        const GLenum drawBuffers[2] = {GL_COLOR_ATTACHMENT0, settings.bloom ? (GLenum)GL_COLOR_ATTACHMENT1 : (GLenum)GL_NONE};
+        glDrawBuffers(2, drawBuffers);
+        const float color[4] = {clearColor.r, clearColor.g, clearColor.b, 1.0f};
+        const float black[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+        glClearBufferfv(GL_COLOR, 0, color);
+        if (settings.bloom)
+            glClearBufferfv(GL_COLOR, 1, black);
+        glClear(GL_DEPTH_BUFFER_BIT);
+    }
+
+    // bloom and composite into the default framebuffer, which is left bound
+    void Finish()
+    {
+        GLState &state = GLState::Instance();
+        state.Disable(GL_DEPTH_TEST);
+        state.Disable(GL_CULL_FACE);
+        state.BindVertexArray(fullscreenVAO);
+
+        int used = std::min(std::max(settings.levels, 1), levelCount);
+        bool bloom = settings.bloom && used > 0;
+        if (bloom)
+        {
+            downsampleTimer.Begin();
+            downsampleShader.use();
+            state.Disable(GL_BLEND);
+            for (int i = 0; i < used; i++)
+                drawLevel(levels[i], i == 0 ? sceneTextures[1] : levels[i - 1].texture);
+            downsampleTimer.End();
+
+            // every smaller level is added onto the next larger one
+            upsampleTimer.Begin();
+            upsampleShader.use();
+            state.Enable(GL_BLEND);
+            state.BlendFunc(GL_ONE, GL_ONE);
+            for (int i = used - 1; i > 0; i--)
+                drawLevel(levels[i - 1], levels[i].texture);
+            state.BlendFunc(GL_ONE, GL_ZERO);
+            upsampleTimer.End();
+        }
+
+        compositeTimer.Begin();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, width, height);
+        state.Disable(GL_BLEND);
+        compositeShader.use();
+        compositeShader.setFloat(bloomIntensity, bloom ? settings.intensity : 0.0f);
+        compositeShader.setFloat(exposure, settings.exposure);
+        compositeShader.setInt(tonemap, settings.tonemap);
+        state.BindTexture(0, GL_TEXTURE_2D, sceneTextures[0]);
+        state.BindTexture(1, GL_TEXTURE_2D, bloom ? levels[0].texture : sceneTextures[1]);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        compositeTimer.End();
+
+        state.Enable(GL_BLEND);
+        state.Enable(GL_DEPTH_TEST);
+
+        timings.downsample = bloom ? downsampleTimer.AverageMilliseconds() : 0.0;
+        timings.upsample = bloom ? upsampleTimer.AverageMilliseconds() : 0.0;
+        timings.composite = compositeTimer.AverageMilliseconds();
+    }
+
+    BloomBlockData BlockData() const
+    {
+        BloomBlockData data = {};
+        data.threshold = settings.threshold;
+        data.knee = std::max(settings.knee, 0.0f);
+        return data;
+    }
+
+    const Timings &LastTimings() const
+    {
+        return timings;
+    }
+
+    // levels of the chain at the current size, the upper limit of settings.levels
+    int LevelCount() const
+    {
+        return levelCount;
+    }
+
+private:
+    struct Level {
+        unsigned int framebuffer = 0;
+        unsigned int texture = 0;
+        int width = 0, height = 0;
+    };
+
+    Shader &downsampleShader;
+    Shader &upsampleShader;
+    Shader &compositeShader;
+    Shader::Uniform bloomIntensity, exposure, tonemap;
+    unsigned int fullscreenVAO = 0;
+
+    unsigned int sceneFramebuffer = 0;
+    unsigned int sceneTextures[2] = {0, 0};  // color, bright part
+    unsigned int depthBuffer = 0;
+    Level levels[MaxLevels];
+    int levelCount = 0;
+    int width = 0, height = 0;
+    bool complete = false;
+
+    GpuTimer downsampleTimer, upsampleTimer, compositeTimer;
+    Timings timings;
+
+    // full-screen triangle into level, sampling source
+    static void drawLevel(const Level &level, unsigned int source)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, level.framebuffer);
+        glViewport(0, 0, level.width, level.height);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_2D, source);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    static unsigned int createTexture(GLenum internalFormat, int width, int height, GLint filter)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RGB, GL_FLOAT, nullptr);
+        GpuMemory::Instance().TrackTexture(texture, internalFormat, width, height, 1, 1, GpuMemory::RenderTarget, "Post-process");
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    void release()
+    {
+        GLState &state = GLState::Instance();
+        for (unsigned int &texture : sceneTextures)
+        {
+            if (texture != 0)
+                state.DeleteTexture(texture);
+            texture = 0;
+        }
+        for (Level &level : levels)
+        {
+            if (level.texture != 0)
+                state.DeleteTexture(level.texture);
+            if (level.framebuffer != 0)
+                glDeleteFramebuffers(1, &level.framebuffer);
+            level = Level();
+        }
+        levelCount = 0;
+        if (depthBuffer != 0)
+        {
+            glDeleteRenderbuffers(1, &depthBuffer);
+            GpuMemory::Instance().Release(GpuMemory::Renderbuffer, depthBuffer);
+        }
+        if (sceneFramebuffer != 0)
+            glDeleteFramebuffers(1, &sceneFramebuffer);
+        depthBuffer = sceneFramebuffer = 0;
+        complete = false;
+    }
+};
+
+#endif
@@ -0,0 +1,382 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/trace_recorder.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Hierarchical frame profiler. Zones are opened and closed with the PROFILE_ZONE and
+// PROFILE_GPU_ZONE macros below and nest like the scopes they are declared in. Every zone gets
+// its CPU time, GPU zones also their GPU time from a pair of GL_TIMESTAMP queries. Timestamps nest
+// freely and don't disturb the GL_TIME_ELAPSED queries of GpuTimer.
+//
+// The queries of a frame are read Latency frames later. If they are still not done by then the
+// GPU times of that frame are dropped instead of waited for, so profiling never stalls the
+// pipeline. LastFrame is therefore a few frames old, History keeps the per-zone times of the
+// last HistoryFrames frames.
+//
+// While the TraceRecorder captures, the zones of the captured frames are handed to it once they are
+// collected, the GPU zones moved onto the CPU clock with a GL_TIMESTAMP read at the capture start.
+//
+// Zones only count on the thread that calls BeginFrame, the GL thread. The queries are never
+// deleted, like GLState the profiler lives as long as the program and they go with the context.
+class Profiler
+{
+public:
+    static const unsigned int Latency = 4;
+    static const unsigned int HistoryFrames = 300;
+
+    struct Zone {
+        const char *name = "";
+        int depth = 0;
+        int parent = -1;
+        bool gpu = false;
+        // milliseconds since the start of the frame, on the CPU and on the GPU
+        double cpuBegin = 0.0, cpuEnd = 0.0;
+        double gpuBegin = 0.0, gpuEnd = 0.0;
+        unsigned int query = 0;            // index of the begin query in the slot, end is query + 1
+
+        double CpuMs() const
+        {
+            return cpuEnd - cpuBegin;
+        }
+
+        double GpuMs() const
+        {
+            return gpuEnd - gpuBegin;
+        }
+    };
+
+    // zones in the order they were opened, the frame itself is zone 0
+    struct Frame {
+        unsigned long long number = 0;
+        bool gpuValid = false;
+        bool traced = false;               // part of a TraceRecorder capture
+        double start = 0.0;                // TraceRecorder time of the frame start, microseconds
+        std::vector<Zone> zones;
+    };
+
+    // times of one zone name over the last HistoryFrames frames, summed when it ran more than once
+    struct Series {
+        std::string name;
+        int depth = 0;
+        float cpuMs[HistoryFrames] = {};
+        float gpuMs[HistoryFrames] = {};
+    };
+
+    bool Enabled = true;
+
+    static Profiler &Instance()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    // collects the frame recorded Latency frames ago and starts recording the next one
+    void BeginFrame()
+    {
+        owner = std::this_thread::get_id();
+        TraceRecorder &trace = TraceRecorder::Instance();
+        // a trace capture records even with the overlay switched off
+        recording = Enabled || trace.Capturing();
+        if (!recording)
+            return;
+        Slot &slot = slots[frameNumber % Latency];
+        if (slot.pending)
+            collect(slot);
+        int traceFrame = trace.CaptureFrame();
+        if (traceFrame == 0)
+            calibrateGpuClock();
+        slot.frame.number = frameNumber++;
+        slot.frame.traced = traceFrame >= 0;
+        slot.frame.zones.clear();
+        slot.usedQueries = 0;
+        slot.pending = true;
+        frameStart = std::chrono::steady_clock::now();
+        slot.frame.start = trace.Microseconds(frameStart);
+        open.clear();
+        BeginZone("Frame", true);
+    }
+
+    void EndFrame()
+    {
+        if (!recording)
+            return;
+        while (!open.empty())
+            EndZone(open.back());
+        recording = false;
+    }
+
+    // returns the zone index for EndZone, -1 if it is not recorded
+    int BeginZone(const char *name, bool gpu)
+    {
+        if (!recording || std::this_thread::get_id() != owner)
+            return -1;
+        Slot &slot = current();
+        Zone zone;
+        zone.name = name;
+        zone.depth = (int)open.size();
+        zone.parent = open.empty() ? -1 : open.back();
+        zone.gpu = gpu;
+        zone.cpuBegin = now();
+        if (gpu)
+        {
+            zone.query = reserveQueries(slot);
+            glQueryCounter(slot.queries[zone.query], GL_TIMESTAMP);
+        }
+        slot.frame.zones.push_back(zone);
+        open.push_back((int)slot.frame.zones.size() - 1);
+        return open.back();
+    }
+
+    // closes zone and every zone opened inside it that is still open
+    void EndZone(int zone)
+    {
+        if (zone < 0 || !recording || std::this_thread::get_id() != owner)
+            return;
+        Slot &slot = current();
+        while (!open.empty())
+        {
+            int index = open.back();
+            open.pop_back();
+            Zone &closed = slot.frame.zones[index];
+            closed.cpuEnd = now();
+            if (closed.gpu)
+                glQueryCounter(slot.queries[closed.query + 1], GL_TIMESTAMP);
+            if (index == zone)
+                break;
+        }
+    }
+
+    // waits for the GPU and collects every frame still in flight, e.g. before writing a trace at exit.
+    // must not be called between BeginFrame and EndFrame.
+    void Flush()
+    {
+        if (recording)
+            return;
+        glFinish();
+        for (unsigned long long number = frameNumber - std::min<unsigned long long>(frameNumber, Latency); number < frameNumber; number++)
+            if (slots[number % Latency].pending)
+                collect(slots[number % Latency]);
+    }
+
+    // newest frame whose GPU results were collected (or dropped)
+    const Frame &LastFrame() const
+    {
+        return last;
+    }
+
+    const std::vector<Series> &History() const
+    {
+        return series;
+    }
+
+    // index of the oldest entry in the Series rings
+    unsigned int HistoryOffset() const
+    {
+        return historyCursor;
+    }
+
+    // frames in the Series rings so far, at most HistoryFrames
+    unsigned int HistoryCount() const
+    {
+        return historyCount;
+    }
+
+    // frames whose GPU results were not ready after Latency frames
+    unsigned int DroppedFrames() const
+    {
+        return dropped;
+    }
+
+private:
+    struct Slot {
+        Frame frame;
+        std::vector<unsigned int> queries;
+        unsigned int usedQueries = 0;
+        bool pending = false;
+    };
+
+    Slot slots[Latency];
+    unsigned long long frameNumber = 0;
+    bool recording = false;
+    std::thread::id owner;
+    std::chrono::steady_clock::time_point frameStart;
+    std::vector<int> open;
+
+    Frame last;
+    std::vector<Series> series;
+    std::unordered_map<std::string, size_t> seriesIndices;
+    unsigned int historyCursor = 0;
+    unsigned int historyCount = 0;
+    unsigned int dropped = 0;
+    // TraceRecorder microseconds minus GPU timestamp microseconds
+    double gpuClockOffset = 0.0;
+
+    Profiler() = default;
+
+    Slot &current()
+    {
+        return slots[(frameNumber - 1) % Latency];
+    }
+
+    double now() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+    }
+
+    void calibrateGpuClock()
+    {
+        GLint64 gpuNow = 0;
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        gpuClockOffset = TraceRecorder::Instance().Now() - gpuNow / 1.0e3;
+    }
+
+    // two queries of slot for one zone, more are generated when a frame has more GPU zones than before
+    static unsigned int reserveQueries(Slot &slot)
+    {
+        if (slot.usedQueries + 2 > slot.queries.size())
+        {
+            size_t grown = std::max<size_t>(slot.queries.size() * 2, 32);
+            size_t added = grown - slot.queries.size();
+            slot.queries.resize(grown);
+            glGenQueries((GLsizei)added, slot.queries.data() + grown - added);
+        }
+        slot.usedQueries += 2;
+        return slot.usedQueries - 2;
+    }
+
+    // reads the timestamps of slot if the GPU is done with them, then records the frame
+    void collect(Slot &slot)
+    {
+        slot.pending = false;
+        Frame &frame = slot.frame;
+        // the end of the frame zone is the last timestamp of the frame, the others are done when it is
+        GLint available = 0;
+        if (!frame.zones.empty())
+            glGetQueryObjectiv(slot.queries[frame.zones[0].query + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        frame.gpuValid = available != 0;
+        GLuint64 origin = 0;
+        if (frame.gpuValid)
+        {
+            glGetQueryObjectui64v(slot.queries[frame.zones[0].query], GL_QUERY_RESULT, &origin);
+            for (Zone &zone : frame.zones)
+            {
+                if (!zone.gpu)
+                    continue;
+                GLuint64 begin = 0, end = 0;
+                glGetQueryObjectui64v(slot.queries[zone.query], GL_QUERY_RESULT, &begin);
+                glGetQueryObjectui64v(slot.queries[zone.query + 1], GL_QUERY_RESULT, &end);
+                zone.gpuBegin = (double)(long long)(begin - origin) / 1.0e6;
+                zone.gpuEnd = (double)(long long)(end - origin) / 1.0e6;
+            }
+        }
+        else
+        {
+            dropped++;
+        }
+        record(frame);
+        if (frame.traced)
+            trace(frame, origin);
+    }
+
+    // hands the zones of frame to the TraceRecorder, origin is the GPU timestamp of its start
+    void trace(const Frame &frame, GLuint64 origin)
+    {
+        TraceRecorder &recorder = TraceRecorder::Instance();
+        unsigned int cpuTrack = recorder.CurrentThread();
+        unsigned int gpuTrack = recorder.Track("GPU");
+        double gpuStart = origin / 1.0e3 + gpuClockOffset;
+        std::vector<TraceRecorder::Event> events;
+        for (const Zone &zone : frame.zones)
+        {
+            TraceRecorder::Event event;
+            event.name = zone.name;
+            event.category = "frame";
+            event.thread = cpuTrack;
+            event.begin = frame.start + zone.cpuBegin * 1.0e3;
+            event.duration = zone.CpuMs() * 1.0e3;
+            events.push_back(event);
+            if (zone.gpu && frame.gpuValid)
+            {
+                event.category = "gpu";
+                event.thread = gpuTrack;
+                event.begin = gpuStart + zone.gpuBegin * 1.0e3;
+                event.duration = zone.GpuMs() * 1.0e3;
+                events.push_back(event);
+            }
+        }
+        recorder.AddFrame(events);
+    }
+
+    void record(const Frame &frame)
+    {
+        last = frame;
+        for (Series &entry : series)
+        {
+            entry.cpuMs[historyCursor] = 0.0f;
+            entry.gpuMs[historyCursor] = 0.0f;
+        }
+        for (const Zone &zone : frame.zones)
+        {
+            auto found = seriesIndices.find(zone.name);
+            if (found == seriesIndices.end())
+            {
+                found = seriesIndices.emplace(zone.name, series.size()).first;
+                series.emplace_back();
+                series.back().name = zone.name;
+                series.back().depth = zone.depth;
+            }
+            Series &entry = series[found->second];
+            entry.cpuMs[historyCursor] += (float)zone.CpuMs();
+            if (frame.gpuValid && zone.gpu)
+                entry.gpuMs[historyCursor] += (float)zone.GpuMs();
+        }
+        historyCursor = (historyCursor + 1) % HistoryFrames;
+        if (historyCount < HistoryFrames)
+            historyCount++;
+    }
+};
+
+// opens a zone for the lifetime of the object
+class ProfileZone
+{
+public:
+    ProfileZone(const char *name, bool gpu) : zone(Profiler::Instance().BeginZone(name, gpu))
+    {
+    }
+
+    ~ProfileZone()
+    {
+        Profiler::Instance().EndZone(zone);
+    }
+
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+private:
+    int zone;
+};
+
+// build with -DRG_NO_PROFILER to compile the zones out completely
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#ifndef RG_NO_PROFILER
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name, false)
+#define PROFILE_GPU_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name, true)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_GPU_ZONE(name) ((void)0)
+#endif
+
+#endif
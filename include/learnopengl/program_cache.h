@@ -0,0 +1,263 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// ARB_get_program_binary (core in 4.1), not part of the 3.3 glad loader
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+// Linked programs saved with glGetProgramBinary and restored with glProgramBinary, so a warm start
+// skips compiling and linking. One file per program in the cache directory, named after a hash of
+// the final sources (defines included) and the vendor, renderer and version strings of the driver.
+// A binary the driver refuses (driver update, different GPU) is deleted and the program is built
+// from source as if there was no entry.
+//
+// File layout: Header | binary
+class ProgramCache
+{
+public:
+    static const uint32_t Version = 1;
+    // larger lengths in a header are taken as a corrupt file
+    static const uint32_t MaxBinarySize = 64u << 20;
+
+    struct Stats {
+        unsigned int hits = 0;
+        unsigned int misses = 0;
+        double loadMilliseconds = 0.0;   // spent restoring binaries
+        double savedMilliseconds = 0.0;  // compile time of the hits minus loadMilliseconds
+    };
+
+    // loads the entry points with the GL loader (glfwGetProcAddress, eglGetProcAddress) once a
+    // context is current. Without this, or without binary formats, every program is compiled.
+    // set RG_NO_PROGRAM_CACHE in the environment to always compile (cold start timings).
+    static void Init(GLADloadproc load)
+    {
+        State &state = get();
+        if (getenv("RG_NO_PROGRAM_CACHE") != nullptr)
+            return;
+        state.getProgramBinary = (GetProgramBinary)load("glGetProgramBinary");
+        state.programBinary = (ProgramBinary)load("glProgramBinary");
+        state.programParameteri = (ProgramParameteri)load("glProgramParameteri");
+        GLint formats = 0;
+        if (state.getProgramBinary && state.programBinary && state.programParameteri)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        state.enabled = formats > 0;
+        if (!state.enabled)
+        {
+            std::cout << "PROGRAM_CACHE:: no program binary formats, shaders are always compiled" << std::endl;
+            return;
+        }
+        for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+        {
+            const char *value = (const char*)glGetString(name);
+            state.driver += value ? value : "";
+            state.driver += '\n';
+        }
+    }
+
+    static bool Enabled()
+    {
+        return get().enabled;
+    }
+
+    // identifies a program by its stage sources and the driver
+    static uint64_t Key(const std::vector<const std::string*> &sources)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&hash](const std::string &text) {
+            for (char c : text)
+            {
+                hash ^= (unsigned char)c;
+                hash *= 1099511628211ull;
+            }
+            // separator, so moving text from one stage to the next changes the key
+            hash ^= 0xff;
+            hash *= 1099511628211ull;
+        };
+        for (const std::string *source : sources)
+            add(*source);
+        add(get().driver);
+        return hash;
+    }
+
+    // restores the program from the entry for key. false if there is none or the driver rejected
+    // it; program can then be built from source as usual.
+    static bool Load(uint64_t key, unsigned int program)
+    {
+        State &state = get();
+        if (!state.enabled)
+            return false;
+        auto start = std::chrono::steady_clock::now();
+
+        std::string path = cachePath(key);
+        FILE *in = fopen(path.c_str(), "rb");
+        if (!in)
+        {
+            state.stats.misses++;
+            return false;
+        }
+        Header header;
+        std::vector<char> binary;
+        bool ok = fread(&header, sizeof(header), 1, in) == 1 && memcmp(header.magic, magic(), sizeof(header.magic)) == 0
+                  && header.version == Version && header.key == key && header.length <= MaxBinarySize;
+        if (ok)
+        {
+            binary.resize(header.length);
+            ok = fread(binary.data(), 1, binary.size(), in) == binary.size();
+        }
+        fclose(in);
+
+        GLint linked = 0;
+        if (ok)
+        {
+            state.programBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+            glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        }
+        if (!linked)
+        {
+            std::cout << "PROGRAM_CACHE:: stale entry " << path << ", compiling from source" << std::endl;
+            remove(path.c_str());
+            state.stats.misses++;
+            return false;
+        }
+
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        state.stats.hits++;
+        state.stats.loadMilliseconds += milliseconds;
+        state.stats.savedMilliseconds += std::max(header.buildMilliseconds - milliseconds, 0.0);
+        return true;
+    }
+
+    // call before linking a program that is going to be stored
+    static void PrepareLink(unsigned int program)
+    {
+        if (get().enabled)
+            get().programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // saves a successfully linked program. buildMilliseconds (compile and link) is kept with it to
+    // report the time a later hit saves. Written next to its final name and renamed into place.
+    static void Store(uint64_t key, unsigned int program, double buildMilliseconds)
+    {
+        State &state = get();
+        if (!state.enabled)
+            return;
+        GLint linked = 0, length = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (!linked || length <= 0)
+            return;
+
+        Header header;
+        memcpy(header.magic, magic(), sizeof(header.magic));
+        header.version = Version;
+        header.key = key;
+        header.buildMilliseconds = buildMilliseconds;
+        std::vector<char> binary((size_t)length);
+        GLsizei written = 0;
+        state.getProgramBinary(program, length, &written, &header.format, binary.data());
+        if (written <= 0)
+            return;
+        header.length = (uint32_t)written;
+
+        mkdir(Directory().c_str(), 0755);
+        std::string target = cachePath(key);
+        std::string temporary = target + ".tmp";
+        FILE *out = fopen(temporary.c_str(), "wb");
+        if (!out)
+        {
+            std::cout << "ERROR::PROGRAM_CACHE:: could not write " << temporary << std::endl;
+            return;
+        }
+        fwrite(&header, sizeof(header), 1, out);
+        fwrite(binary.data(), 1, header.length, out);
+        bool ok = ferror(out) == 0;
+        ok = fclose(out) == 0 && ok;
+        if (ok && rename(temporary.c_str(), target.c_str()) == 0)
+            return;
+        std::cout << "ERROR::PROGRAM_CACHE:: could not write " << target << std::endl;
+        remove(temporary.c_str());
+    }
+
+    static const Stats &GetStats()
+    {
+        return get().stats;
+    }
+
+    static void Report(std::ostream &out)
+    {
+        if (!get().enabled)
+            return;
+        const Stats &stats = get().stats;
+        out << "PROGRAM_CACHE:: " << stats.hits << " hits, " << stats.misses << " misses, loaded in "
+            << stats.loadMilliseconds << " ms, saved " << stats.savedMilliseconds << " ms" << std::endl;
+    }
+
+    static std::string Directory()
+    {
+        return "resources/cache";
+    }
+
+private:
+    typedef void (APIENTRYP GetProgramBinary)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+    typedef void (APIENTRYP ProgramBinary)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+    typedef void (APIENTRYP ProgramParameteri)(GLuint program, GLenum pname, GLint value);
+
+    struct State {
+        bool enabled = false;
+        std::string driver;
+        GetProgramBinary getProgramBinary = nullptr;
+        ProgramBinary programBinary = nullptr;
+        ProgramParameteri programParameteri = nullptr;
+        Stats stats;
+    };
+
+    struct Header {
+        char     magic[8];
+        uint32_t version;
+        GLenum   format;
+        uint64_t key;
+        double   buildMilliseconds;
+        uint32_t length;
+        uint32_t reserved = 0;
+    };
+
+    static State &get()
+    {
+        static State state;
+        return state;
+    }
+
+    static const char *magic()
+    {
+        return "RGPROG\0\0";
+    }
+
+    static std::string cachePath(uint64_t key)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.prog", (unsigned long long)key);
+        return Directory() + '/' + name;
+    }
+};
+
+#endif
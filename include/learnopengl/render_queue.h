@@ -0,0 +1,563 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <learnopengl/bounds.h>
+#include <learnopengl/gl_state.h>
+#include <learnopengl/hiz_culler.h>
+#include <learnopengl/mesh.h>
+#include <learnopengl/model.h>
+#include <learnopengl/shader.h>
+#include <learnopengl/shader_variants.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+// One draw call with everything needed to issue it. Packets either draw a Mesh (its textures and
+// index range) or raw vertices of a VAO with a single texture on unit 0.
+struct DrawPacket {
+    uint64_t key = 0;                 // filled in by RenderQueue::Submit
+
+    Shader *shader = nullptr;
+    unsigned int VAO = 0;
+    Mesh *mesh = nullptr;
+    unsigned int texture = 0;         // only for packets without a mesh
+    Shader::Uniform sampler;          // sampler pointed at unit 0 for texture, optional
+
+    // draw without a mesh: glDrawElementsBaseVertex over range if indexed, glDrawArrays otherwise
+    bool indexed = false;
+    ArenaRange range;
+    unsigned int vertexCount = 0;
+
+    // instanced packets re-upload their matrices through instanceSource right before drawing
+    unsigned int instanceCount = 0;
+    Model *instanceSource = nullptr;
+    const vector<glm::mat4> *instances = nullptr;
+
+    bool hasModel = false;
+    Shader::Uniform modelUniform;
+    glm::mat4 model = glm::mat4(1.0f);
+
+    bool cullFace = true;
+    bool transparent = false;
+    float depth = 0.0f;               // distance to the viewer
+
+    // world space bounds, packets that have them are frustum culled on Submit
+    bool hasBounds = false;
+    AABB bounds;
+};
+
+// Collects the draw packets of a frame, sorts them by a 64-bit key and executes them while
+// tracking the bound program, VAO, texture set and cull state, so each is only changed when
+// the next packet actually needs something different.
+//
+// Key layout, opaque packets (front to back inside a state bucket):
+//   63: 0 | 62-55: program | 54-47: VAO | 46-31: texture set | 30-0: depth
+// transparent packets (back to front, state only breaks ties):
+//   63: 1 | 62-31: inverted depth | 30-23: program | 22-15: VAO | 14-0: texture set
+//
+// Programs, VAOs and texture sets are numbered in order of first appearance, the numbers stay
+// stable for the lifetime of the queue.
+//
+// With a frustum set, objects are culled on submission: a model placement is dropped if its
+// bounds are outside the frustum, and of a visible model every mesh is tested on its own.
+// Instanced models only keep the instances that are inside. Objects inside the frustum can
+// additionally be tested against a Hi-Z pyramid of the previous frames (SetOcclusion).
+// A caller that already culled its placements (e.g. with a BVH query) passes placementsCulled
+// to SetFrustum, then only the meshes of the submitted models are tested against the frustum.
+//
+// With a depth pre-pass enabled the opaque packets are first drawn depth only, in the same order
+// and with position-only shaders, and then shaded with GL_EQUAL and depth writes off, so every
+// pixel runs the expensive fragment shader once no matter how much geometry overlaps there.
+// The pre-pass shaders must compute gl_Position exactly like the lit ones, both declared invariant.
+//
+// The opaque and the transparent packets can be executed separately, e.g. into different
+// framebuffers with a deferred lighting pass in between.
+class RenderQueue
+{
+public:
+    struct Stats {
+        unsigned int packets = 0;
+        unsigned int programChanges = 0;
+        unsigned int vaoChanges = 0;
+        unsigned int textureChanges = 0;
+        unsigned int cullChanges = 0;
+        unsigned int prePassPackets = 0;
+        // changes the same packets would have caused in submission order, minus the ones issued
+        unsigned int stateChangesAvoided = 0;
+    };
+
+    // objects (model placements, instances and packets with bounds) seen by Submit since Clear
+    struct CullStats {
+        unsigned int visible = 0;
+        unsigned int culled = 0;
+        unsigned int meshesCulled = 0;  // meshes of visible models that were outside on their own
+        unsigned int occluded = 0;      // inside the frustum but hidden according to the Hi-Z pyramid
+    };
+
+    // which of the submitted packets Execute draws
+    enum class Pass {
+        All,
+        Opaque,
+        Transparent
+    };
+
+    // everything further away is clamped into the last depth bucket
+    float MaxDepth = 100.0f;
+
+    void Clear()
+    {
+        packets.clear();
+        sorted = false;
+        cullStats = CullStats();
+        instanceListsUsed = 0;
+    }
+
+    // world space frustum for culling the following submissions. With placementsCulled everything
+    // submitted is taken to be inside, only the meshes of models are still tested.
+    void SetFrustum(const Frustum &frustum, bool placementsCulled = false)
+    {
+        this->frustum = frustum;
+        culling = true;
+        this->placementsCulled = placementsCulled;
+    }
+
+    void DisableCulling()
+    {
+        culling = false;
+        placementsCulled = false;
+    }
+
+    // objects the caller culled before submitting, so the stats still cover the whole scene
+    void AddCulled(unsigned int count)
+    {
+        cullStats.culled += count;
+    }
+
+    // objects that pass the frustum test are also tested against occluder, nullptr turns that off
+    void SetOcclusion(const HiZCuller *occluder)
+    {
+        occlusion = occluder;
+    }
+
+    // shader draws single packets with their matrix in the "model" uniform, instancedShader the
+    // instanced ones. Packets drawn from arena use its position-only VAO in the pre-pass.
+    void EnableDepthPrePass(Shader &shader, Shader &instancedShader, const GeometryArena *arena = nullptr)
+    {
+        prePass.shader = &shader;
+        prePass.instancedShader = &instancedShader;
+        prePass.modelUniform = shader.GetUniform("model");
+        prePass.arena = arena;
+    }
+
+    void DisableDepthPrePass()
+    {
+        prePass.shader = nullptr;
+    }
+
+    bool DepthPrePassEnabled() const
+    {
+        return prePass.shader != nullptr;
+    }
+
+    // viewer position used for the depth of Submit(Model...) packets
+    void SetViewer(const glm::vec3 &position)
+    {
+        viewer = position;
+    }
+
+    void Submit(DrawPacket packet)
+    {
+        if (packet.hasBounds && !visible(packet.bounds))
+            return;
+        packet.key = makeKey(packet);
+        packets.push_back(packet);
+        sorted = false;
+    }
+
+    // one packet per mesh of model, drawn with the model matrix in modelUniform
+    void Submit(Model &model, Shader &shader, Shader::Uniform modelUniform, const glm::mat4 &modelMatrix, bool cullFace = true)
+    {
+        submitModel(model, modelMatrix, cullFace, [&shader, modelUniform](Mesh&, DrawPacket &packet) {
+            packet.shader = &shader;
+            packet.modelUniform = modelUniform;
+        });
+    }
+
+    // same, every mesh drawn with the variant for features plus its own texture set
+    void Submit(Model &model, ShaderVariants &variants, const ShaderFeatures &features, const glm::mat4 &modelMatrix, bool cullFace = true)
+    {
+        submitModel(model, modelMatrix, cullFace, [&variants, &features](Mesh &mesh, DrawPacket &packet) {
+            ShaderVariants::Variant &variant = variants.Get(mesh.Features(features));
+            packet.shader = &variant.shader;
+            packet.modelUniform = variant.model;
+        });
+    }
+
+    // one instanced packet per mesh of model, drawing the instances inside the frustum.
+    // instances must stay alive until Execute returns.
+    void SubmitInstanced(Model &model, Shader &shader, const vector<glm::mat4> &allInstances, bool cullFace = true)
+    {
+        submitInstanced(model, allInstances, cullFace, [&shader](Mesh&, DrawPacket &packet) {
+            packet.shader = &shader;
+        });
+    }
+
+    // same, with the INSTANCED variant for features plus the texture set of each mesh
+    void SubmitInstanced(Model &model, ShaderVariants &variants, ShaderFeatures features, const vector<glm::mat4> &allInstances, bool cullFace = true)
+    {
+        features.instanced = true;
+        submitInstanced(model, allInstances, cullFace, [&variants, &features](Mesh &mesh, DrawPacket &packet) {
+            packet.shader = &variants.Get(mesh.Features(features)).shader;
+        });
+    }
+
+    // sorts and draws the packets of pass submitted since the last Clear. The stats add up over the
+    // passes executed after one Clear, the depth pre-pass runs with the opaque packets.
+    void Execute(Pass pass = Pass::All)
+    {
+        if (!sorted)
+        {
+            stats = Stats();
+            stats.packets = (unsigned int)packets.size();
+
+            // what the frame would have cost without sorting
+            Tracker unsorted;
+            for (const DrawPacket &packet : packets)
+                unsorted.Apply(packet, false);
+            unsortedChanges = unsorted.Total();
+
+            std::sort(packets.begin(), packets.end(), [](const DrawPacket &a, const DrawPacket &b) { return a.key < b.key; });
+            sorted = true;
+        }
+
+        // transparent packets sort after all opaque ones
+        auto firstTransparent = std::partition_point(packets.begin(), packets.end(), [](const DrawPacket &packet) { return !packet.transparent; });
+        auto begin = pass == Pass::Transparent ? firstTransparent : packets.begin();
+        auto end = pass == Pass::Opaque ? firstTransparent : packets.end();
+
+        Tracker tracker;
+        if (DepthPrePassEnabled() && pass != Pass::Transparent)
+            tracker.instances = depthPrePass();
+
+        GLState &state = GLState::Instance();
+        for (auto packet = begin; packet != end; ++packet)
+        {
+            tracker.Apply(*packet, true);
+            // the depth of pre-passed packets is already final
+            bool depthDone = DepthPrePassEnabled() && inPrePass(*packet);
+            state.DepthFunc(depthDone ? GL_EQUAL : GL_LESS);
+            state.DepthMask(!depthDone);
+            execute(*packet);
+        }
+        state.DepthFunc(GL_LESS);
+        state.DepthMask(true);
+
+        stats.programChanges += tracker.programChanges;
+        stats.vaoChanges += tracker.vaoChanges;
+        stats.textureChanges += tracker.textureChanges;
+        stats.cullChanges += tracker.cullChanges;
+        unsigned int issued = stats.programChanges + stats.vaoChanges + stats.textureChanges + stats.cullChanges;
+        stats.stateChangesAvoided = unsortedChanges > issued ? unsortedChanges - issued : 0;
+    }
+
+    const Stats &LastStats() const
+    {
+        return stats;
+    }
+
+    const CullStats &LastCullStats() const
+    {
+        return cullStats;
+    }
+
+private:
+    // state bound while walking the packets, and how often each piece of it changed
+    struct Tracker {
+        unsigned int program = 0;
+        unsigned int VAO = 0;
+        uint64_t textureSet = 0;
+        int cullFace = -1;
+        const vector<glm::mat4> *instances = nullptr;
+        bool first = true;
+
+        unsigned int programChanges = 0;
+        unsigned int vaoChanges = 0;
+        unsigned int textureChanges = 0;
+        unsigned int cullChanges = 0;
+
+        // updates the tracked state for packet, issuing the GL calls for what changed if bind is set
+        void Apply(const DrawPacket &packet, bool bind)
+        {
+            uint64_t packetTextures = TextureSetOf(packet);
+            if (first || packet.shader->ID != program)
+            {
+                program = packet.shader->ID;
+                programChanges++;
+                if (bind)
+                    packet.shader->use();
+                // samplers are program state, the new program has to get them too
+                textureSet = ~packetTextures;
+            }
+            if (packet.instanceCount > 0 && packet.instances != instances)
+            {
+                instances = packet.instances;
+                if (bind)
+                    packet.instanceSource->UploadInstances(*packet.instances);
+            }
+            if (first || packet.VAO != VAO)
+            {
+                VAO = packet.VAO;
+                vaoChanges++;
+            }
+            // always asked for: the first instance upload of a model outside an arena rebinds VAOs,
+            // GLState drops the call when nothing changed
+            if (bind)
+                GLState::Instance().BindVertexArray(VAO);
+            if (packetTextures != textureSet)
+            {
+                textureSet = packetTextures;
+                textureChanges++;
+                if (bind)
+                    bindTextures(packet);
+            }
+            if ((int)packet.cullFace != cullFace)
+            {
+                cullFace = packet.cullFace;
+                cullChanges++;
+                if (bind)
+                    GLState::Instance().SetEnabled(GL_CULL_FACE, packet.cullFace);
+            }
+            first = false;
+        }
+
+        unsigned int Total() const
+        {
+            return programChanges + vaoChanges + textureChanges + cullChanges;
+        }
+
+        static void bindTextures(const DrawPacket &packet)
+        {
+            if (packet.mesh)
+            {
+                packet.mesh->BindTextures(*packet.shader);
+                return;
+            }
+            packet.shader->setInt(packet.sampler, 0);
+            GLState::Instance().BindTexture(0, GL_TEXTURE_2D, packet.texture);
+        }
+    };
+
+    vector<DrawPacket> packets;
+    bool sorted = false;
+    unsigned int unsortedChanges = 0;
+    glm::vec3 viewer = glm::vec3(0.0f);
+    Stats stats;
+
+    struct PrePass {
+        Shader *shader = nullptr;
+        Shader *instancedShader = nullptr;
+        Shader::Uniform modelUniform;
+        const GeometryArena *arena = nullptr;
+    };
+    PrePass prePass;
+
+    Frustum frustum;
+    bool culling = false;
+    bool placementsCulled = false;
+    const HiZCuller *occlusion = nullptr;
+    CullStats cullStats;
+    // per-frame lists of visible instances, a deque so packets can keep pointers into it
+    std::deque<vector<glm::mat4>> instanceLists;
+    size_t instanceListsUsed = 0;
+
+    // setShader(mesh, packet) fills in the program and its model uniform
+    template <typename SetShader>
+    void submitModel(Model &model, const glm::mat4 &modelMatrix, bool cullFace, SetShader setShader)
+    {
+        if (!visible(model.Bounds.Transformed(modelMatrix)))
+            return;
+        for (Mesh &mesh : model.meshes)
+        {
+            if (culling && model.meshes.size() > 1 && !frustum.Intersects(mesh.Bounds.Transformed(modelMatrix)))
+            {
+                cullStats.meshesCulled++;
+                continue;
+            }
+            DrawPacket packet;
+            setShader(mesh, packet);
+            packet.VAO = mesh.VAO;
+            packet.mesh = &mesh;
+            packet.hasModel = true;
+            packet.model = modelMatrix;
+            packet.cullFace = cullFace;
+            packet.depth = glm::length(glm::vec3(modelMatrix[3]) - viewer);
+            Submit(packet);
+        }
+    }
+
+    template <typename SetShader>
+    void submitInstanced(Model &model, const vector<glm::mat4> &allInstances, bool cullFace, SetShader setShader)
+    {
+        const vector<glm::mat4> *visibleInstances = &allInstances;
+        if (culling || occlusion)
+        {
+            if (instanceListsUsed == instanceLists.size())
+                instanceLists.emplace_back();
+            vector<glm::mat4> &inside = instanceLists[instanceListsUsed++];
+            inside.clear();
+            for (const glm::mat4 &instance : allInstances)
+                if (visible(model.Bounds.Transformed(instance)))
+                    inside.push_back(instance);
+            visibleInstances = &inside;
+        }
+        const vector<glm::mat4> &instances = *visibleInstances;
+        if (instances.empty())
+            return;
+        for (Mesh &mesh : model.meshes)
+        {
+            DrawPacket packet;
+            setShader(mesh, packet);
+            packet.VAO = mesh.VAO;
+            packet.mesh = &mesh;
+            packet.instanceCount = (unsigned int)instances.size();
+            packet.instanceSource = &model;
+            packet.instances = &instances;
+            packet.cullFace = cullFace;
+            packet.depth = glm::length(glm::vec3(instances[0][3]) - viewer);
+            Submit(packet);
+        }
+    }
+
+    // counts the object as visible or culled
+    bool visible(const AABB &worldBounds)
+    {
+        if (culling && !placementsCulled && !frustum.Intersects(worldBounds))
+        {
+            cullStats.culled++;
+            return false;
+        }
+        if (occlusion && occlusion->Occluded(worldBounds))
+        {
+            cullStats.occluded++;
+            return false;
+        }
+        cullStats.visible++;
+        return true;
+    }
+
+    std::unordered_map<unsigned int, uint64_t> programIndices;
+    std::unordered_map<unsigned int, uint64_t> vaoIndices;
+    std::unordered_map<uint64_t, uint64_t> textureSetIndices;
+
+    // FNV-1a over the texture names of the packet, identifies a texture set
+    static uint64_t TextureSetOf(const DrawPacket &packet)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&hash](unsigned int id) {
+            hash ^= id;
+            hash *= 1099511628211ull;
+        };
+        if (packet.mesh)
+        {
+            for (const Texture &texture : packet.mesh->textures)
+                add(texture.id);
+        }
+        else
+        {
+            add(packet.texture);
+        }
+        return hash;
+    }
+
+    template <typename Key>
+    static uint64_t indexOf(std::unordered_map<Key, uint64_t> &indices, Key key, uint64_t limit)
+    {
+        auto found = indices.find(key);
+        if (found != indices.end())
+            return found->second;
+        uint64_t index = std::min<uint64_t>(indices.size(), limit);
+        indices[key] = index;
+        return index;
+    }
+
+    uint64_t makeKey(const DrawPacket &packet)
+    {
+        uint64_t program = indexOf(programIndices, packet.shader->ID, 0xffull);
+        uint64_t vao = indexOf(vaoIndices, packet.VAO, 0xffull);
+        uint64_t textures = indexOf(textureSetIndices, TextureSetOf(packet), 0x7fffull);
+        double depth = std::min(std::max(packet.depth / MaxDepth, 0.0f), 1.0f);
+
+        if (!packet.transparent)
+        {
+            uint64_t quantized = (uint64_t)(depth * 0x7fffffff);
+            return program << 55 | vao << 47 | (textures & 0xffff) << 31 | quantized;
+        }
+        uint64_t inverted = 0xffffffffull - (uint64_t)(depth * 0xffffffffull);
+        return 1ull << 63 | inverted << 31 | program << 23 | vao << 15 | (textures & 0x7fff);
+    }
+
+    // opaque packets with a known transform; the others would not get the same depth in both passes
+    static bool inPrePass(const DrawPacket &packet)
+    {
+        return !packet.transparent && (packet.hasModel || packet.instanceCount > 0);
+    }
+
+    // draws the depth of the opaque packets with color writes off, returns the instance list
+    // that is left in the instance buffers
+    const vector<glm::mat4> *depthPrePass()
+    {
+        GLState &state = GLState::Instance();
+        state.ColorMask(false);
+        state.DepthFunc(GL_LESS);
+        state.DepthMask(true);
+
+        const vector<glm::mat4> *instances = nullptr;
+        for (const DrawPacket &packet : packets)
+        {
+            if (!inPrePass(packet))
+                continue;
+            stats.prePassPackets++;
+            Shader &shader = packet.instanceCount > 0 ? *prePass.instancedShader : *prePass.shader;
+            shader.use();
+            if (packet.instanceCount > 0 && packet.instances != instances)
+            {
+                instances = packet.instances;
+                packet.instanceSource->UploadInstances(*packet.instances);
+            }
+            bool fromArena = prePass.arena && packet.VAO == prePass.arena->VAO();
+            state.BindVertexArray(fromArena ? prePass.arena->PositionVAO() : packet.VAO);
+            state.SetEnabled(GL_CULL_FACE, packet.cullFace);
+            if (packet.instanceCount == 0)
+                shader.setMat4(prePass.modelUniform, packet.model);
+            draw(packet);
+        }
+        state.ColorMask(true);
+        return instances;
+    }
+
+    static void execute(const DrawPacket &packet)
+    {
+        if (packet.hasModel)
+            packet.shader->setMat4(packet.modelUniform, packet.model);
+        draw(packet);
+    }
+
+    static void draw(const DrawPacket &packet)
+    {
+        if (packet.mesh)
+            packet.mesh->DrawGeometry(packet.instanceCount);
+        else if (packet.indexed)
+            glDrawElementsBaseVertex(GL_TRIANGLES, packet.range.indexCount, GL_UNSIGNED_INT, packet.range.IndexOffset(), packet.range.baseVertex);
+        else
+            glDrawArrays(GL_TRIANGLES, 0, packet.vertexCount);
+    }
+};
+
+#endif
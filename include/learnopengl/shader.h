@@ -4,18 +4,35 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <learnopengl/gl_state.h>
+#include <learnopengl/program_cache.h>
+
+#include <algorithm>
+#include <chrono>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
 #include <common.h>
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+
+    // location of a uniform, resolved once. Hold on to it and pass it to the set functions
+    // instead of the name to keep string handling out of the per-frame path.
+    struct Uniform {
+        int location = -1;
+    };
+
+    // constructor generates the shader on the fly, or restores it from the ProgramCache.
+    // defines ("NAME" or "NAME=VALUE") are inserted into every stage right after #version.
+    // #include "file" lines are replaced by that file, relative to the including stage.
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr,
+           const std::vector<std::string> &defines = std::vector<std::string>())
     {
         std::string vertexPathString(vertexPath);
         std::string fragmentPathString(fragmentPath);
@@ -64,6 +81,26 @@ public:
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
+        vertexCode = resolveIncludes(vertexCode, vertexPathString);
+        fragmentCode = resolveIncludes(fragmentCode, fragmentPathString);
+        if (geometryPath != nullptr)
+            geometryCode = resolveIncludes(geometryCode, geometryPath);
+        if (!defines.empty())
+        {
+            vertexCode = injectDefines(vertexCode, defines);
+            fragmentCode = injectDefines(fragmentCode, defines);
+            if (geometryPath != nullptr)
+                geometryCode = injectDefines(geometryCode, defines);
+        }
+        auto buildStart = std::chrono::steady_clock::now();
+        uint64_t cacheKey = ProgramCache::Key({&vertexCode, &fragmentCode, &geometryCode});
+        ID = glCreateProgram();
+        if (ProgramCache::Load(cacheKey, ID))
+        {
+            fromCache = true;
+            reflectUniforms();
+            return;
+        }
         const char* vShaderCode = vertexCode.c_str();
         const char * fShaderCode = fragmentCode.c_str();
         // 2. compile shaders
@@ -89,13 +126,15 @@ public:
             checkCompileErrors(geometry, "GEOMETRY");
         }
         // shader Program
-        ID = glCreateProgram();
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
         if(geometryPath != nullptr)
             glAttachShader(ID, geometry);
+        ProgramCache::PrepareLink(ID);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
+        ProgramCache::Store(cacheKey, ID, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart).count());
+        reflectUniforms();
         // delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
@@ -103,72 +142,241 @@ public:
             glDeleteShader(geometry);
 
     }
+    // true if the program binary came from the ProgramCache instead of being compiled
+    bool FromCache() const
+    {
+        return fromCache;
+    }
+    // different for every Shader the process builds. GL hands out a deleted program's ID again,
+    // so caches keyed by program use this instead.
+    uint64_t Serial() const
+    {
+        return serial;
+    }
     // activate the shader
     // ------------------------------------------------------------------------
     void use() 
     { 
-        glUseProgram(ID); 
+        GLState::Instance().UseProgram(ID);
+    }
+    // attaches the uniform block blockName to a binding point, see UniformBuffer.
+    // programs without that block are left alone.
+    void BindUniformBlock(const std::string &blockName, unsigned int binding) const
+    {
+        GLuint index = glGetUniformBlockIndex(ID, blockName.c_str());
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, binding);
+    }
+    // returns the handle for an active uniform, an invalid handle (ignored by the setters) otherwise
+    Uniform GetUniform(const std::string &name) const
+    {
+        Uniform uniform;
+        auto found = uniformLocations.find(name);
+        if (found != uniformLocations.end())
+            uniform.location = found->second;
+        return uniform;
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
+    void setBool(Uniform uniform, bool value) const
+    {
+        glUniform1i(uniform.location, (int)value);
+    }
     void setBool(const std::string &name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        setBool(GetUniform(name), value);
     }
     // ------------------------------------------------------------------------
+    void setInt(Uniform uniform, int value) const
+    {
+        glUniform1i(uniform.location, value);
+    }
     void setInt(const std::string &name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        setInt(GetUniform(name), value);
     }
     // ------------------------------------------------------------------------
+    void setFloat(Uniform uniform, float value) const
+    {
+        glUniform1f(uniform.location, value);
+    }
     void setFloat(const std::string &name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        setFloat(GetUniform(name), value);
     }
     // ------------------------------------------------------------------------
+    void setVec2(Uniform uniform, const glm::vec2 &value) const
+    {
+        glUniform2fv(uniform.location, 1, &value[0]);
+    }
     void setVec2(const std::string &name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec2(GetUniform(name), value);
     }
     void setVec2(const std::string &name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        glUniform2f(GetUniform(name).location, x, y);
     }
     // ------------------------------------------------------------------------
+    void setVec3(Uniform uniform, const glm::vec3 &value) const
+    {
+        glUniform3fv(uniform.location, 1, &value[0]);
+    }
     void setVec3(const std::string &name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec3(GetUniform(name), value);
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        glUniform3f(GetUniform(name).location, x, y, z);
     }
     // ------------------------------------------------------------------------
+    void setVec4(Uniform uniform, const glm::vec4 &value) const
+    {
+        glUniform4fv(uniform.location, 1, &value[0]);
+    }
     void setVec4(const std::string &name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec4(GetUniform(name), value);
     }
     void setVec4(const std::string &name, float x, float y, float z, float w) 
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        glUniform4f(GetUniform(name).location, x, y, z, w);
     }
     // ------------------------------------------------------------------------
+    void setMat2(Uniform uniform, const glm::mat2 &mat) const
+    {
+        glUniformMatrix2fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
+    }
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat2(GetUniform(name), mat);
     }
     // ------------------------------------------------------------------------
+    void setMat3(Uniform uniform, const glm::mat3 &mat) const
+    {
+        glUniformMatrix3fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
+    }
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat3(GetUniform(name), mat);
     }
     // ------------------------------------------------------------------------
+    void setMat4(Uniform uniform, const glm::mat4 &mat) const
+    {
+        glUniformMatrix4fv(uniform.location, 1, GL_FALSE, &mat[0][0]);
+    }
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat4(GetUniform(name), mat);
     }
 
 private:
+    bool fromCache = false;
+    uint64_t serial = nextSerial();
+
+    static uint64_t nextSerial()
+    {
+        static uint64_t next = 0;
+        return ++next;
+    }
+
+    // one level of #include "file", the included file can't include further. #line directives keep
+    // compile errors of the including file pointing at its own lines.
+    static std::string resolveIncludes(const std::string &code, const std::string &path)
+    {
+        if (code.find("#include") == std::string::npos)
+            return code;
+        std::string directory = path.substr(0, path.find_last_of('/') + 1);
+        std::istringstream lines(code);
+        std::string line, result;
+        int number = 0;
+        while (std::getline(lines, line))
+        {
+            number++;
+            size_t open = line.find('"');
+            size_t close = line.rfind('"');
+            if (line.compare(0, 8, "#include") != 0 || open == std::string::npos || close <= open)
+            {
+                result += line + "\n";
+                continue;
+            }
+            std::string includePath = directory + line.substr(open + 1, close - open - 1);
+            std::ifstream file(includePath);
+            if (!file)
+            {
+                std::cout << "ERROR::SHADER::INCLUDE_NOT_FOUND " << includePath << std::endl;
+                continue;
+            }
+            std::stringstream included;
+            included << file.rdbuf();
+            result += "#line 1\n" + included.str() + "\n#line " + std::to_string(number + 1) + "\n";
+        }
+        return result;
+    }
+
+    // the #version line has to stay first, the defines go on the lines after it
+    static std::string injectDefines(const std::string &code, const std::vector<std::string> &defines)
+    {
+        std::string block;
+        for (const std::string &define : defines)
+        {
+            size_t equals = define.find('=');
+            if (equals == std::string::npos)
+                block += "#define " + define + "\n";
+            else
+                block += "#define " + define.substr(0, equals) + " " + define.substr(equals + 1) + "\n";
+        }
+        size_t version = code.find("#version");
+        if (version == std::string::npos)
+            return block + code;
+        size_t lineEnd = code.find('\n', version);
+        if (lineEnd == std::string::npos)
+            return code + "\n" + block;
+        // keep the line numbers of compile errors pointing into the file
+        int nextLine = (int)std::count(code.begin(), code.begin() + lineEnd, '\n') + 2;
+        block += "#line " + std::to_string(nextLine) + "\n";
+        return code.substr(0, lineEnd + 1) + block + code.substr(lineEnd + 1);
+    }
+
+    // name -> location of every active uniform, filled once after linking
+    std::unordered_map<std::string, int> uniformLocations;
+
+    // asks the driver for all active uniforms once, so setting them never has to.
+    // array elements are registered both as "name[i]" and, for the first one, as "name".
+    void reflectUniforms()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> buffer(maxLength + 1);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type;
+            glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+            std::string name(buffer.data(), length);
+            GLint location = glGetUniformLocation(ID, name.c_str());
+            // members of uniform blocks have no location
+            if (location < 0)
+                continue;
+            uniformLocations[name] = location;
+
+            size_t bracket = name.rfind("[0]");
+            if (bracket != std::string::npos && bracket + 3 == name.size())
+            {
+                std::string base = name.substr(0, bracket);
+                uniformLocations[base] = location;
+                for (GLint element = 1; element < size; element++)
+                {
+                    std::string elementName = base + "[" + std::to_string(element) + "]";
+                    uniformLocations[elementName] = glGetUniformLocation(ID, elementName.c_str());
+                }
+            }
+        }
+    }
+
     // utility function for checking shader compilation/linking errors.
     // ------------------------------------------------------------------------
     void checkCompileErrors(GLuint shader, std::string type)
@@ -0,0 +1,123 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <learnopengl/shader.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// compile-time features of the lit model shaders, each one becomes a #define (see model_lighting.fs)
+struct ShaderFeatures {
+    unsigned int pointLights = 0;  // POINT_LIGHTS=N, left out for 0
+    bool spotLight = false;        // SPOTLIGHT
+    bool specularMap = false;      // HAS_SPECULAR_MAP
+    bool normalMap = false;        // HAS_NORMAL_MAP
+    bool instanced = false;        // INSTANCED, model matrix per instance on attributes 5-8
+    bool clustered = false;        // CLUSTERED, point lights from the light clusters (see light_clusters.h)
+    bool shadows = false;          // SHADOWS, directional light shadowed by the cascades (see shadow_cascades.h)
+
+    uint32_t Key() const
+    {
+        return pointLights << 6 | (uint32_t)shadows << 5 | (uint32_t)clustered << 4 | (uint32_t)spotLight << 3 | (uint32_t)specularMap << 2 | (uint32_t)normalMap << 1 | (uint32_t)instanced;
+    }
+
+    std::vector<std::string> Defines() const
+    {
+        std::vector<std::string> defines;
+        if (pointLights > 0)
+            defines.push_back("POINT_LIGHTS=" + std::to_string(pointLights));
+        if (spotLight)
+            defines.push_back("SPOTLIGHT");
+        if (specularMap)
+            defines.push_back("HAS_SPECULAR_MAP");
+        if (normalMap)
+            defines.push_back("HAS_NORMAL_MAP");
+        if (instanced)
+            defines.push_back("INSTANCED");
+        if (clustered)
+            defines.push_back("CLUSTERED");
+        if (shadows)
+            defines.push_back("SHADOWS");
+        return defines;
+    }
+};
+
+// All permutations of one vertex/fragment shader pair. A variant is compiled the first time it is
+// asked for and kept from then on, together with the uniforms every lit draw sets.
+class ShaderVariants
+{
+public:
+    struct Variant {
+        Shader shader;
+        Shader::Uniform model, view, projection;
+
+        Variant(const std::string &vertexPath, const std::string &fragmentPath, const std::vector<std::string> &defines)
+            : shader(vertexPath.c_str(), fragmentPath.c_str(), nullptr, defines)
+        {
+            model = shader.GetUniform("model");
+            view = shader.GetUniform("view");
+            projection = shader.GetUniform("projection");
+        }
+    };
+
+    // setup runs once for every new variant with its program in use, for uniform block bindings
+    // and uniforms that never change
+    ShaderVariants(std::string vertexPath, std::string fragmentPath, std::function<void(Shader&)> setup = nullptr)
+        : vertexPath(std::move(vertexPath)), fragmentPath(std::move(fragmentPath)), setup(std::move(setup))
+    {
+    }
+
+    ShaderVariants(const ShaderVariants&) = delete;
+    ShaderVariants& operator=(const ShaderVariants&) = delete;
+
+    Variant &Get(const ShaderFeatures &features)
+    {
+        uint32_t key = features.Key();
+        auto found = variants.find(key);
+        if (found != variants.end())
+            return *found->second;
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::string> defines = features.Defines();
+        std::unique_ptr<Variant> variant(new Variant(vertexPath, fragmentPath, defines));
+        variant->shader.use();
+        if (setup)
+            setup(variant->shader);
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "SHADER::VARIANT " << fragmentPath << " [";
+        for (size_t i = 0; i < defines.size(); i++)
+            std::cout << (i > 0 ? " " : "") << defines[i];
+        std::cout << "] " << milliseconds << " ms" << (variant->shader.FromCache() ? " (program cache)" : "") << std::endl;
+
+        Variant &compiled = *variant;
+        variants.emplace(key, std::move(variant));
+        return compiled;
+    }
+
+    // every variant compiled so far, e.g. to set per-frame uniforms
+    template <typename Function>
+    void ForEach(Function function)
+    {
+        for (auto &entry : variants)
+            function(*entry.second);
+    }
+
+    size_t Count() const
+    {
+        return variants.size();
+    }
+
+private:
+    std::string vertexPath, fragmentPath;
+    std::function<void(Shader&)> setup;
+    std::unordered_map<uint32_t, std::unique_ptr<Variant>> variants;
+};
+
+#endif
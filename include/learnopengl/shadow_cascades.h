@@ -0,0 +1,242 @@
+#ifndef SHADOW_CASCADES_H
+#define SHADOW_CASCADES_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <learnopengl/bounds.h>
+#include <learnopengl/gl_state.h>
+#include <learnopengl/gpu_memory.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// std140 layout of the ShadowBlock uniform block in lighting.glsl
+struct ShadowBlockData {
+    glm::mat4 cascadeMatrices[4];    // world to shadow map clip space
+    glm::vec4 cascadeSplits;         // view depth where each cascade ends
+    glm::vec4 cascadeTexelSizes;     // world size of one shadow map texel
+    glm::vec4 cameraForward;
+    glm::ivec4 cascadeCount;         // x
+};
+static_assert(sizeof(ShadowBlockData) == 320, "std140 ShadowBlock is 320 bytes");
+
+// Cascaded shadow maps for the directional light. The view frustum up to Settings::distance is
+// split into slices, near ones shorter than far ones, and each slice gets its own orthographic
+// shadow map in one layer of a depth texture array. The scene shaders pick the layer by view
+// depth (SHADOWS in lighting.glsl).
+//
+// Each cascade covers the bounding sphere of its slice. The sphere only depends on the shape of
+// the slice, so the covered area does not change size while the camera turns, and the projection
+// is moved in whole texels only, so the shadow edges don't crawl while the camera moves.
+//
+// Casters are drawn with depth clamping: anything between the light and the cascade is flattened
+// onto its near plane instead of clipped, so the cascade box does not have to reach towards the
+// light and CasterFrustum leaves that side open.
+class ShadowCascades
+{
+public:
+    static const int MaxCascades = 4;
+    // texture unit of the shadow map array, below the light cluster buffers
+    static const unsigned int ShadowUnit = 12;
+
+    struct Settings {
+        int cascades = 3;            // 2 to MaxCascades
+        int resolution = 2048;       // texels per side of every cascade
+        float distance = 60.0f;      // view depth where shadows end
+        float splitLambda = 0.75f;   // 0 splits evenly, 1 logarithmically
+        float slopeBias = 2.0f;      // glPolygonOffset while drawing casters
+        float constantBias = 4.0f;
+    };
+
+    Settings settings;
+
+    ShadowCascades() = default;
+    ShadowCascades(const ShadowCascades&) = delete;
+    ShadowCascades& operator=(const ShadowCascades&) = delete;
+
+    ~ShadowCascades()
+    {
+        release();
+    }
+
+    // deletes the shadow map while the context is still there, the next Update creates it again
+    void Release()
+    {
+        release();
+    }
+
+    // fits the cascades to the camera, (re)creating the shadow map when the settings changed
+    void Update(const glm::mat4 &view, float fovY, float aspect, float nearPlane, const glm::vec3 &lightDirection)
+    {
+        int count = std::min(std::max(settings.cascades, 1), (int)MaxCascades);
+        int resolution = std::max(settings.resolution, 16);
+        if (count != layers || resolution != size)
+            create(count, resolution);
+
+        float farPlane = std::max(settings.distance, nearPlane * 2.0f);
+        float tanY = std::tan(fovY * 0.5f), tanX = tanY * aspect;
+        glm::mat4 inverseView = glm::inverse(view);
+        glm::vec3 direction = glm::normalize(lightDirection);
+        glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        cameraForward = -glm::normalize(glm::vec3(inverseView[2]));
+
+        float start = nearPlane;
+        for (int i = 0; i < layers; i++)
+        {
+            float fraction = (float)(i + 1) / layers;
+            float logarithmic = nearPlane * std::pow(farPlane / nearPlane, fraction);
+            float uniform = nearPlane + (farPlane - nearPlane) * fraction;
+            float end = settings.splitLambda * logarithmic + (1.0f - settings.splitLambda) * uniform;
+            Cascade &cascade = cascades[i];
+            cascade.split = end;
+
+            // sphere around the slice, centered on the view axis: where its distance to the near and
+            // the far corners is the same, clamped to the slice
+            float nearCorner = start * start * (1.0f + tanX * tanX + tanY * tanY);
+            float farCorner = end * end * (1.0f + tanX * tanX + tanY * tanY);
+            float center = std::min(std::max((farCorner - nearCorner) / (2.0f * (end - start)), start), end);
+            float radius = std::sqrt(std::max(nearCorner + center * center - 2.0f * center * start,
+                                              farCorner + center * center - 2.0f * center * end));
+            // whole 1/16 units, float noise in the radius would rescale the map every frame
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+            glm::vec3 worldCenter = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -center, 1.0f));
+
+            cascade.view = glm::lookAt(worldCenter - direction * radius, worldCenter, up);
+            cascade.projection = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2.0f * radius);
+            // world origin onto a texel corner, every shadow map texel then stays on the same spot
+            glm::vec4 origin = cascade.projection * cascade.view * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            float texels = resolution * 0.5f;
+            cascade.projection[3][0] += (std::round(origin.x * texels) - origin.x * texels) / texels;
+            cascade.projection[3][1] += (std::round(origin.y * texels) - origin.y * texels) / texels;
+            cascade.texelSize = 2.0f * radius / resolution;
+
+            cascade.casters = Frustum::FromMatrix(cascade.projection * cascade.view);
+            // near plane, casters towards the light are clamped onto it
+            cascade.casters.planes[4] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            start = end;
+        }
+    }
+
+    int Count() const
+    {
+        return layers;
+    }
+
+    const glm::mat4 &View(int cascade) const
+    {
+        return cascades[cascade].view;
+    }
+
+    const glm::mat4 &Projection(int cascade) const
+    {
+        return cascades[cascade].projection;
+    }
+
+    // world space volume whose objects can cast shadows into the cascade
+    const Frustum &CasterFrustum(int cascade) const
+    {
+        return cascades[cascade].casters;
+    }
+
+    // binds and clears the layer of cascade, depth clamp and polygon offset on for the casters
+    void BeginCascade(int cascade)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, cascade);
+        glViewport(0, 0, size, size);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glEnable(GL_DEPTH_CLAMP);
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(settings.slopeBias, settings.constantBias);
+    }
+
+    // back to target with the given viewport
+    void End(unsigned int target, int width, int height)
+    {
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glDisable(GL_DEPTH_CLAMP);
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+        glViewport(0, 0, width, height);
+    }
+
+    void Bind() const
+    {
+        GLState::Instance().BindTexture(ShadowUnit, GL_TEXTURE_2D_ARRAY, texture);
+    }
+
+    ShadowBlockData BlockData() const
+    {
+        ShadowBlockData data = {};
+        for (int i = 0; i < layers; i++)
+        {
+            data.cascadeMatrices[i] = cascades[i].projection * cascades[i].view;
+            data.cascadeSplits[i] = cascades[i].split;
+            data.cascadeTexelSizes[i] = cascades[i].texelSize;
+        }
+        data.cameraForward = glm::vec4(cameraForward, 0.0f);
+        data.cascadeCount = glm::ivec4(layers, 0, 0, 0);
+        return data;
+    }
+
+private:
+    struct Cascade {
+        glm::mat4 view = glm::mat4(1.0f);
+        glm::mat4 projection = glm::mat4(1.0f);
+        Frustum casters;
+        float split = 0.0f;
+        float texelSize = 0.0f;
+    };
+
+    Cascade cascades[MaxCascades];
+    glm::vec3 cameraForward = glm::vec3(0.0f, 0.0f, -1.0f);
+    unsigned int framebuffer = 0;
+    unsigned int texture = 0;
+    int layers = 0;
+    int size = 0;
+
+    // depth array with hardware comparison, sampled as sampler2DArrayShadow. Outside the map is lit.
+    void create(int count, int resolution)
+    {
+        release();
+        layers = count;
+        size = resolution;
+        glGenTextures(1, &texture);
+        GLState::Instance().BindTexture(ShadowUnit, GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, layers, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        GpuMemory::Instance().TrackTexture(texture, GL_DEPTH_COMPONENT24, size, size, layers, 1, GpuMemory::RenderTarget, "Shadow cascades");
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        const float border[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::SHADOW_CASCADES:: " << layers << " cascades of " << size << "x" << size
+                      << " are not a complete framebuffer" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void release()
+    {
+        if (texture != 0)
+            GLState::Instance().DeleteTexture(texture);
+        if (framebuffer != 0)
+            glDeleteFramebuffers(1, &framebuffer);
+        texture = framebuffer = 0;
+        layers = size = 0;
+    }
+};
+
+#endif
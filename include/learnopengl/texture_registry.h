@@ -0,0 +1,127 @@
+#ifndef TEXTURE_REGISTRY_H
+#define TEXTURE_REGISTRY_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/gl_state.h>
+#include <learnopengl/texture_service.h>
+
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+// Process-wide table of 2D textures loaded from files, keyed by canonical absolute path.
+// Every Model and loadTexture in main.cpp go through it, so an image referenced from several
+// places is decoded and uploaded once. Entries are reference counted and the texture is deleted
+// when the last reference is released. Only used from the GL thread.
+class TextureRegistry
+{
+public:
+    static TextureRegistry &Instance()
+    {
+        static TextureRegistry registry;
+        return registry;
+    }
+
+    // returns the texture for path, loading it on first use
+    unsigned int Acquire(const std::string &path)
+    {
+        std::string key = canonicalPath(path);
+        auto entry = entries.find(key);
+        if (entry != entries.end())
+        {
+            entry->second.references++;
+            entry->second.sharedUses++;
+            return entry->second.id;
+        }
+
+        Entry created;
+        created.id = LoadTexture2D(path);
+        entries[key] = created;
+        keys[created.id] = key;
+        return created.id;
+    }
+
+    void Release(unsigned int textureID)
+    {
+        auto key = keys.find(textureID);
+        if (key == keys.end())
+            return;
+        auto entry = entries.find(key->second);
+        if (--entry->second.references > 0)
+            return;
+        GLState::Instance().DeleteTexture(textureID);
+        entries.erase(entry);
+        keys.erase(key);
+    }
+
+    unsigned int UniqueTextures() const
+    {
+        return (unsigned int)entries.size();
+    }
+
+    // bytes of video memory that would have gone into duplicate copies without the registry.
+    // sizes are read back from the driver, so call it after the textures are uploaded.
+    size_t SavedBytes() const
+    {
+        size_t saved = 0;
+        for (const auto &entry : entries)
+            saved += entry.second.sharedUses * TextureBytes(entry.second.id);
+        return saved;
+    }
+
+    void Report(std::ostream &out) const
+    {
+        unsigned int sharedUses = 0;
+        for (const auto &entry : entries)
+            sharedUses += entry.second.sharedUses;
+        out << "TEXTURE::REGISTRY " << entries.size() << " unique textures, " << sharedUses
+            << " duplicate loads avoided, " << SavedBytes() / 1024 << " KB of VRAM saved" << std::endl;
+    }
+
+    // estimated size of a 2D texture: level 0 times a third more if it has mipmaps
+    static size_t TextureBytes(unsigned int textureID)
+    {
+        GLint width = 0, height = 0, internalFormat = 0, minFilter = 0;
+        GLState::Instance().BindTexture(GL_TEXTURE_2D, textureID);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &minFilter);
+
+        size_t texelBytes = 4;
+        if (internalFormat == GL_RED || internalFormat == GL_R8)
+            texelBytes = 1;
+        else if (internalFormat == GL_RGB || internalFormat == GL_RGB8)
+            texelBytes = 3;
+        size_t bytes = (size_t)width * height * texelBytes;
+        if (minFilter != GL_LINEAR && minFilter != GL_NEAREST)
+            bytes += bytes / 3;
+        return bytes;
+    }
+
+private:
+    struct Entry {
+        unsigned int id = 0;
+        unsigned int references = 1;
+        unsigned int sharedUses = 0;  // acquires that were served from the table
+    };
+
+    std::unordered_map<std::string, Entry> entries;
+    std::unordered_map<unsigned int, std::string> keys;
+
+    TextureRegistry() = default;
+
+    // "a/b/../c.png" and "a/c.png" must end up in the same entry
+    static std::string canonicalPath(const std::string &path)
+    {
+        char resolved[PATH_MAX];
+        if (realpath(path.c_str(), resolved))
+            return resolved;
+        return path;
+    }
+};
+
+#endif
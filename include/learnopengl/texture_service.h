@@ -0,0 +1,423 @@
+#ifndef TEXTURE_SERVICE_H
+#define TEXTURE_SERVICE_H
+
+#include <glad/glad.h>
+#include <stb_image.h>
+
+#include <learnopengl/gl_state.h>
+#include <learnopengl/gpu_memory.h>
+#include <learnopengl/thread_pool.h>
+#include <learnopengl/trace_recorder.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+
+// decoded pixels of an image file, produced on any thread and uploaded on the GL thread.
+struct ImageData {
+    int width = 0;
+    int height = 0;
+    int nrComponents = 0;
+    unsigned char *data = nullptr;
+};
+
+// Asynchronous texture loading. Load2D/LoadCubemap return a texture name right away that holds
+// a 1x1 placeholder, the image files are decoded on the thread pool and Update (called once per
+// frame on the GL thread) uploads the finished ones through a pixel buffer object into that same
+// texture name. Callers never have to swap ids, the picture just appears once it is ready.
+// The six faces of a cubemap are one request: they are uploaded together, and only if all of them
+// decoded to the same size, so the cubemap is never sampled incomplete (black).
+class TextureService
+{
+public:
+    // upper bound for bytes uploaded by a single Update, so one frame never stalls on many images.
+    // at least one image is uploaded per call, however big it is.
+    size_t UploadBudget = 16 * 1024 * 1024;
+
+    explicit TextureService(ThreadPool &pool) : pool(pool)
+    {
+        current() = this;
+    }
+
+    // waits for decodes that are still running, their results are dropped.
+    // no GL objects are deleted here since the context may already be gone.
+    ~TextureService()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this]() { return decoding == 0; });
+        while (!decoded.empty())
+        {
+            for (ImageData &image : decoded.front().images)
+                stbi_image_free(image.data);
+            decoded.pop();
+        }
+        if (current() == this)
+            current() = nullptr;
+    }
+
+    TextureService(const TextureService&) = delete;
+    TextureService& operator=(const TextureService&) = delete;
+
+    // the service used by LoadTexture2D, nullptr if none was created
+    static TextureService *Current()
+    {
+        return current();
+    }
+
+    // 2D texture with mipmaps and repeat wrapping, filled in from path once it is decoded
+    unsigned int Load2D(const std::string &path)
+    {
+        unsigned int textureID = createPlaceholder(GL_TEXTURE_2D, path);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        decode(Request{textureID, GL_TEXTURE_2D, {path}});
+        return textureID;
+    }
+
+    // cubemap with faces in +X, -X, +Y, -Y, +Z, -Z order, it keeps the placeholder until all six are in
+    unsigned int LoadCubemap(const std::vector<std::string> &faces)
+    {
+        unsigned int textureID = createCubemapPlaceholder(faces);
+        decode(Request{textureID, GL_TEXTURE_CUBE_MAP, faces});
+        return textureID;
+    }
+
+    // LoadCubemap without a service: the faces are decoded and uploaded right away on the calling
+    // thread, which has to be the GL thread
+    static unsigned int LoadCubemapNow(const std::vector<std::string> &faces)
+    {
+        unsigned int textureID = createCubemapPlaceholder(faces);
+        Request request{textureID, GL_TEXTURE_CUBE_MAP, faces};
+        std::vector<ImageData> images = decodeImages(request);
+        if (complete(request, images))
+        {
+            GLState::Instance().BindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            for (size_t i = 0; i < images.size(); i++)
+                specify(imageTarget(request, i), images[i], images[i].data);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            track(request, images);
+        }
+        for (ImageData &image : images)
+            stbi_image_free(image.data);
+        return textureID;
+    }
+
+    // uploads decoded images until the budget is used up. Must be called on the GL thread.
+    void Update()
+    {
+        size_t uploaded = 0;
+        while (uploaded < UploadBudget)
+        {
+            Decoded next;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (decoded.empty())
+                    break;
+                next = decoded.front();
+                decoded.pop();
+            }
+            uploaded += upload(next);
+            pending--;
+        }
+    }
+
+    // blocks until every requested image is decoded and uploaded
+    void Finish()
+    {
+        while (pending > 0)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this]() { return !decoded.empty(); });
+            }
+            Update();
+        }
+    }
+
+    // number of requests (an image or the faces of a cubemap) that are still decoding or waiting for upload
+    unsigned int Pending() const
+    {
+        return pending;
+    }
+
+private:
+    struct Request {
+        unsigned int textureID;
+        GLenum target;                     // GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP
+        std::vector<std::string> paths;    // the image, or the faces of the cubemap
+    };
+
+    struct Decoded {
+        Request request;
+        std::vector<ImageData> images;     // one per path, data is null where decoding failed
+    };
+
+    static TextureService *&current()
+    {
+        static TextureService *service = nullptr;
+        return service;
+    }
+
+    ThreadPool &pool;
+    std::queue<Decoded> decoded;
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::condition_variable idle;
+    unsigned int decoding = 0;
+    unsigned int pending = 0;
+    unsigned int pixelBuffer = 0;
+
+    // mid grey, so untextured surfaces don't flash black or white while loading
+    static unsigned int createPlaceholder(GLenum target, const std::string &owner)
+    {
+        static const unsigned char grey[4] = {128, 128, 128, 255};
+        unsigned int textureID;
+        glGenTextures(1, &textureID);
+        GLState::Instance().BindTexture(target, textureID);
+        if (target == GL_TEXTURE_CUBE_MAP)
+        {
+            for (unsigned int i = 0; i < 6; i++)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        }
+        else
+        {
+            glTexImage2D(target, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        }
+        GpuMemory::Instance().TrackTexture(textureID, GL_RGBA, 1, 1, target == GL_TEXTURE_CUBE_MAP ? 6 : 1, 1,
+                                           GpuMemory::AssetTexture, owner);
+        return textureID;
+    }
+
+    static unsigned int createCubemapPlaceholder(const std::vector<std::string> &faces)
+    {
+        unsigned int textureID = createPlaceholder(GL_TEXTURE_CUBE_MAP, faces.empty() ? std::string() : directoryOf(faces[0]));
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        return textureID;
+    }
+
+    static std::string directoryOf(const std::string &path)
+    {
+        return path.substr(0, path.find_last_of('/'));
+    }
+
+    static GLenum imageTarget(const Request &request, size_t image)
+    {
+        return request.target == GL_TEXTURE_CUBE_MAP ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + (GLenum)image : request.target;
+    }
+
+    // cubemap faces are always decoded to RGB, a cubemap is only complete if its faces share one format
+    static std::vector<ImageData> decodeImages(const Request &request)
+    {
+        std::vector<ImageData> images(request.paths.size());
+        int components = request.target == GL_TEXTURE_CUBE_MAP ? 3 : 0;
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            TRACE_SCOPE("Decode image", request.paths[i]);
+            ImageData &image = images[i];
+            image.data = stbi_load(request.paths[i].c_str(), &image.width, &image.height, &image.nrComponents, components);
+            if (components != 0)
+                image.nrComponents = components;
+        }
+        return images;
+    }
+
+    // every image decoded, and for a cubemap six square faces of one size
+    static bool complete(const Request &request, const std::vector<ImageData> &images)
+    {
+        bool cubemap = request.target == GL_TEXTURE_CUBE_MAP;
+        bool ok = true;
+        for (size_t i = 0; i < images.size(); i++)
+        {
+            if (images[i].data)
+                continue;
+            std::cout << (cubemap ? "Cubemap texture" : "Texture") << " failed to load at path: " << request.paths[i] << std::endl;
+            ok = false;
+        }
+        if (!ok || !cubemap)
+            return ok;
+        for (const ImageData &image : images)
+        {
+            if (images.size() != 6 || image.width != images[0].width || image.height != images[0].height
+                || image.width != image.height)
+            {
+                std::cout << "ERROR::TEXTURE_SERVICE:: cubemap " << directoryOf(request.paths[0])
+                          << " needs six square faces of the same size, keeping the placeholder" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // glTexImage2D of one image into the bound texture, pixels is null when they come from the pixel buffer
+    static void specify(GLenum target, const ImageData &image, const void *pixels)
+    {
+        GLenum format = GL_RGB;
+        if (image.nrComponents == 1)
+            format = GL_RED;
+        else if (image.nrComponents == 4)
+            format = GL_RGBA;
+        glTexImage2D(target, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, pixels);
+    }
+
+    static void track(const Request &request, const std::vector<ImageData> &images)
+    {
+        const ImageData &image = images[0];
+        GLenum format = image.nrComponents == 1 ? GL_RED : image.nrComponents == 4 ? GL_RGBA : GL_RGB;
+        if (request.target == GL_TEXTURE_2D)
+        {
+            GpuMemory::Instance().TrackTexture(request.textureID, format, image.width, image.height, 1,
+                                               GpuMemory::MipLevels(image.width, image.height), GpuMemory::AssetTexture,
+                                               request.paths[0], GpuMemory::FileBytes(request.paths[0]));
+        }
+        else
+        {
+            size_t fileBytes = 0;
+            for (const std::string &path : request.paths)
+                fileBytes += GpuMemory::FileBytes(path);
+            GpuMemory::Instance().TrackTexture(request.textureID, format, image.width, image.height, 6, 1,
+                                               GpuMemory::AssetTexture, directoryOf(request.paths[0]), fileBytes);
+        }
+    }
+
+    void decode(Request request)
+    {
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            decoding++;
+        }
+        pool.Enqueue([this, request]() {
+            Decoded result{request, decodeImages(request)};
+            // notify under the lock, the destructor may run as soon as decoding drops to zero
+            std::lock_guard<std::mutex> lock(mutex);
+            decoded.push(result);
+            decoding--;
+            ready.notify_one();
+            idle.notify_all();
+        });
+    }
+
+    // copies the pixels into the pixel buffer and lets the driver pull them from there, one image at
+    // a time. Returns the number of bytes uploaded.
+    size_t upload(Decoded &next)
+    {
+        const Request &request = next.request;
+        TRACE_SCOPE("Upload image", request.target == GL_TEXTURE_CUBE_MAP ? directoryOf(request.paths[0]) : request.paths[0]);
+        size_t uploaded = 0;
+        if (complete(request, next.images))
+        {
+            // rows of 1 and 3 component images are not 4 byte aligned
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            GLState::Instance().BindTexture(request.target, request.textureID);
+            for (size_t i = 0; i < next.images.size(); i++)
+                uploaded += uploadImage(imageTarget(request, i), next.images[i]);
+            if (request.target == GL_TEXTURE_2D)
+                glGenerateMipmap(GL_TEXTURE_2D);
+            track(request, next.images);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+
+        for (ImageData &image : next.images)
+        {
+            stbi_image_free(image.data);
+            image.data = nullptr;
+        }
+        return uploaded;
+    }
+
+    // one image into the bound texture through the pixel buffer
+    size_t uploadImage(GLenum target, const ImageData &image)
+    {
+        size_t bytes = (size_t)image.width * image.height * image.nrComponents;
+
+        if (pixelBuffer == 0)
+            glGenBuffers(1, &pixelBuffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+        // orphan the previous storage so the driver doesn't have to wait for the last upload to finish
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        GpuMemory::Instance().TrackBuffer(pixelBuffer, bytes, GpuMemory::DynamicBuffer, "TextureService upload buffer");
+        void *destination = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (destination)
+        {
+            memcpy(destination, image.data, bytes);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        else
+        {
+            // mapping failed, fall back to a plain client memory upload
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        specify(target, image, destination ? nullptr : image.data);
+        return bytes;
+    }
+};
+
+// loads a 2D texture from file. If a TextureService is running the image is decoded in the background
+// and the returned id holds a placeholder until then, otherwise it is loaded right away.
+inline unsigned int LoadTexture2D(const std::string &path)
+{
+    if (TextureService *service = TextureService::Current())
+        return service->Load2D(path);
+    TRACE_SCOPE("LoadTexture2D", path);
+
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    int width, height, nrComponents;
+    unsigned char *data = stbi_load(path.c_str(), &width, &height, &nrComponents, 0);
+    if (data)
+    {
+        GLenum format;
+        if (nrComponents == 1)
+            format = GL_RED;
+        else if (nrComponents == 3)
+            format = GL_RGB;
+        else if (nrComponents == 4)
+            format = GL_RGBA;
+
+        GLState::Instance().BindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        GpuMemory::Instance().TrackTexture(textureID, format, width, height, 1, GpuMemory::MipLevels(width, height),
+                                           GpuMemory::AssetTexture, path, GpuMemory::FileBytes(path));
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        stbi_image_free(data);
+    }
+    else
+    {
+        std::cout << "Texture failed to load at path: " << path << std::endl;
+        stbi_image_free(data);
+    }
+
+    return textureID;
+}
+
+// loads a cubemap, faces in +X, -X, +Y, -Y, +Z, -Z order. Like LoadTexture2D it goes through the
+// running TextureService if there is one, otherwise it is loaded right away.
+inline unsigned int LoadCubemap(const std::vector<std::string> &faces)
+{
+    if (TextureService *service = TextureService::Current())
+        return service->LoadCubemap(faces);
+    TRACE_SCOPE("LoadCubemap", faces.empty() ? std::string() : faces[0]);
+    return TextureService::LoadCubemapNow(faces);
+}
+
+#endif
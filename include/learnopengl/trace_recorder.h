@@ -0,0 +1,260 @@
+#ifndef TRACE_RECORDER_H
+#define TRACE_RECORDER_H
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Timeline of what the program did, written as a Chrome Trace Event JSON file that chrome://tracing
+// and ui.perfetto.dev open. Two kinds of events end up in it:
+//  - asset loading (model parsing and upload, texture decoding and upload, cubemaps), recorded from
+//    the start on whichever thread does the work, through TRACE_SCOPE
+//  - the profiler zones of the frames of a capture, see Capture. CPU zones are on the track of the
+//    GL thread, GPU zones on a separate "GPU" track (see Profiler)
+// Every thread has its own track, so the overlap of the loader threads is visible.
+// All methods may be called from any thread.
+class TraceRecorder
+{
+public:
+    // load events beyond this are dropped, textures may be streamed for as long as the program runs
+    static const size_t MaxEvents = 1 << 20;
+
+    struct Event {
+        std::string name;
+        const char *category = "";
+        unsigned int thread = 0;
+        double begin = 0.0;                // microseconds since the recorder was created
+        double duration = 0.0;
+        std::string file;                  // asset the event worked on, may be empty
+    };
+
+    static TraceRecorder &Instance()
+    {
+        static TraceRecorder recorder;
+        return recorder;
+    }
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    double Microseconds(std::chrono::steady_clock::time_point time) const
+    {
+        return std::chrono::duration<double, std::micro>(time - origin).count();
+    }
+
+    double Now() const
+    {
+        return Microseconds(std::chrono::steady_clock::now());
+    }
+
+    // track of the calling thread, created on first use
+    unsigned int CurrentThread()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return threadTrack(std::this_thread::get_id());
+    }
+
+    // name shown for the track of the calling thread
+    void NameThread(const std::string &name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        names[threadTrack(std::this_thread::get_id()) - 1] = name;
+    }
+
+    // track that belongs to no thread, e.g. the GPU, created on first use
+    unsigned int Track(const std::string &name)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < names.size(); i++)
+            if (names[i] == name)
+                return (unsigned int)i + 1;
+        names.push_back(name);
+        return (unsigned int)names.size();
+    }
+
+    void AddLoad(Event event)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (loads.size() < MaxEvents)
+            loads.push_back(std::move(event));
+    }
+
+    // records the profiler zones of the next frames and writes the trace to path once they are in
+    void Capture(unsigned int frames, const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (capturing)
+        {
+            std::cout << "TRACE:: a capture is already running" << std::endl;
+            return;
+        }
+        capturing = frames > 0;
+        remaining = frames;
+        inFlight = 0;
+        captured = 0;
+        output = path;
+        frameEvents.clear();
+    }
+
+    bool Capturing() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return capturing;
+    }
+
+    // called by the Profiler when it starts a frame. Returns the index of the frame in the capture,
+    // -1 if the frame is not captured.
+    int CaptureFrame()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!capturing || remaining == 0)
+            return -1;
+        remaining--;
+        inFlight++;
+        return (int)captured++;
+    }
+
+    // called by the Profiler with the zones of a captured frame, once its GPU times are read
+    void AddFrame(std::vector<Event> &events)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Event &event : events)
+            frameEvents.push_back(std::move(event));
+        if (inFlight > 0)
+            inFlight--;
+    }
+
+    // every frame of the capture is in, time to Write
+    bool CaptureComplete() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return capturing && remaining == 0 && inFlight == 0;
+    }
+
+    // writes the load events and the captured frames and ends the capture
+    bool Write()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ofstream out(output);
+        out << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"project_base\"}}";
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            out << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << i + 1
+                << ", \"args\": {\"name\": \"" << escape(names[i]) << "\"}}";
+            out << ",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << i + 1
+                << ", \"args\": {\"sort_index\": " << i + 1 << "}}";
+        }
+        for (const Event &event : loads)
+            writeEvent(out, event);
+        for (const Event &event : frameEvents)
+            writeEvent(out, event);
+        out << "\n]}" << std::endl;
+
+        capturing = false;
+        remaining = 0;
+        inFlight = 0;
+        if (!out)
+        {
+            std::cout << "ERROR::TRACE:: could not write " << output << std::endl;
+            return false;
+        }
+        std::cout << "TRACE:: " << loads.size() << " load events and " << captured << " frames ("
+                  << frameEvents.size() << " zones) written to " << output << std::endl;
+        return true;
+    }
+
+private:
+    const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    mutable std::mutex mutex;
+    std::unordered_map<std::thread::id, unsigned int> threads;
+    std::vector<std::string> names;        // track i + 1, tid 0 is left out
+    std::vector<Event> loads;
+    std::vector<Event> frameEvents;
+    bool capturing = false;
+    unsigned int remaining = 0;
+    unsigned int inFlight = 0;             // captured frames the profiler has not collected yet
+    unsigned int captured = 0;
+    std::string output;
+
+    TraceRecorder() = default;
+
+    // expects the mutex to be held
+    unsigned int threadTrack(std::thread::id id)
+    {
+        auto found = threads.find(id);
+        if (found != threads.end())
+            return found->second;
+        names.push_back("Thread " + std::to_string(threads.size() + 1));
+        threads[id] = (unsigned int)names.size();
+        return (unsigned int)names.size();
+    }
+
+    static void writeEvent(std::ostream &out, const Event &event)
+    {
+        out << ",\n{\"name\": \"" << escape(event.name) << "\", \"cat\": \"" << event.category
+            << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.thread << ", \"ts\": " << event.begin
+            << ", \"dur\": " << event.duration;
+        if (!event.file.empty())
+            out << ", \"args\": {\"file\": \"" << escape(event.file) << "\"}";
+        out << "}";
+    }
+
+    static std::string escape(const std::string &text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                escaped += '\\';
+            if ((unsigned char)c >= 0x20)
+                escaped += c;
+        }
+        return escaped;
+    }
+};
+
+// records a load event for the lifetime of the object
+class TraceScope
+{
+public:
+    TraceScope(const char *name, const std::string &file)
+    {
+        TraceRecorder &recorder = TraceRecorder::Instance();
+        event.name = name;
+        event.category = "load";
+        event.file = file;
+        event.thread = recorder.CurrentThread();
+        event.begin = recorder.Now();
+    }
+
+    ~TraceScope()
+    {
+        TraceRecorder &recorder = TraceRecorder::Instance();
+        event.duration = recorder.Now() - event.begin;
+        recorder.AddLoad(std::move(event));
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    TraceRecorder::Event event;
+};
+
+// compiled out together with the profiler zones by -DRG_NO_PROFILER
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#ifndef RG_NO_PROFILER
+#define TRACE_SCOPE(name, file) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, file)
+#else
+#define TRACE_SCOPE(name, file) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <learnopengl/gpu_memory.h>
+
+#include <cstring>
+#include <string>
+
+// Uniform buffer object holding one T, attached to a fixed binding point that is shared by every
+// program declaring the matching uniform block (see Shader::BindUniformBlock). T must be laid out
+// by the std140 rules, with its padding members written as zero.
+template <typename T>
+class UniformBuffer
+{
+public:
+    const unsigned int Binding;
+
+    explicit UniformBuffer(unsigned int binding) : Binding(binding)
+    {
+        glGenBuffers(1, &ID);
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+        GpuMemory::Instance().TrackBuffer(ID, sizeof(T), GpuMemory::DynamicBuffer, "Uniform block " + std::to_string(binding));
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, Binding, ID);
+    }
+
+    // uploads data with a single glBufferSubData. Nothing is sent if it equals the last upload,
+    // returns whether an upload happened.
+    bool Update(const T &data)
+    {
+        if (uploaded && memcmp(&data, &last, sizeof(T)) == 0)
+            return false;
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        memcpy(&last, &data, sizeof(T));
+        uploaded = true;
+        return true;
+    }
+
+private:
+    unsigned int ID = 0;
+    T last;
+    bool uploaded = false;
+};
+
+#endif
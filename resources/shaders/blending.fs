@@ -1,14 +1,18 @@
 #version 330 core
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 BrightColor;
 
 in vec2 TexCoords;
 
 uniform sampler2D texture1;
 
+#include "bloom.glsl"
+
 void main()
 {             
     vec4 texColor = texture(texture1, TexCoords);
     if(texColor.a < 0.1)
         discard;
     FragColor = texColor;
+    BrightColor = BrightPart(texColor.rgb);
 }
\ No newline at end of file
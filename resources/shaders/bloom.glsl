@@ -0,0 +1,18 @@
+// bright part of a scene color, written to BrightColor by every shader that draws into the HDR
+// target (see PostProcess). Colors fade in over bloomKnee below bloomThreshold instead of
+// switching on at it, so bright edges don't flicker in and out of the bloom.
+
+// std140 mirror of BloomBlockData in post_process.h, bound to BLOOM_BLOCK_BINDING
+layout (std140) uniform BloomBlock {
+    float bloomThreshold;
+    float bloomKnee;
+};
+
+vec4 BrightPart(vec3 color)
+{
+    float brightness = max(color.r, max(color.g, color.b));
+    float soft = clamp(brightness - bloomThreshold + bloomKnee, 0.0, 2.0 * bloomKnee);
+    soft = soft * soft / (4.0 * bloomKnee + 0.0001);
+    float contribution = max(soft, brightness - bloomThreshold) / max(brightness, 0.0001);
+    return vec4(color * contribution, 1.0);
+}
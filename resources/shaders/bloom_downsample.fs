@@ -0,0 +1,19 @@
+#version 330 core
+// dual filter downsample: the center and four diagonal bilinear taps one source texel away,
+// a 4x4 texel footprint per output pixel
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D source;
+
+void main()
+{
+    vec2 offset = 1.0 / vec2(textureSize(source, 0));
+    vec3 sum = texture(source, TexCoords).rgb * 4.0;
+    sum += texture(source, TexCoords - offset).rgb;
+    sum += texture(source, TexCoords + offset).rgb;
+    sum += texture(source, TexCoords + vec2(offset.x, -offset.y)).rgb;
+    sum += texture(source, TexCoords - vec2(offset.x, -offset.y)).rgb;
+    FragColor = vec4(sum / 8.0, 1.0);
+}
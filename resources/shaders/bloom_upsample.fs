@@ -0,0 +1,22 @@
+#version 330 core
+// dual filter upsample: eight bilinear taps in a ring around the pixel, added onto the level
+// below by additive blending
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D source;
+
+void main()
+{
+    vec2 offset = 0.5 / vec2(textureSize(source, 0));
+    vec3 sum = texture(source, TexCoords + vec2(-offset.x * 2.0, 0.0)).rgb;
+    sum += texture(source, TexCoords + vec2(-offset.x, offset.y)).rgb * 2.0;
+    sum += texture(source, TexCoords + vec2(0.0, offset.y * 2.0)).rgb;
+    sum += texture(source, TexCoords + vec2(offset.x, offset.y)).rgb * 2.0;
+    sum += texture(source, TexCoords + vec2(offset.x * 2.0, 0.0)).rgb;
+    sum += texture(source, TexCoords + vec2(offset.x, -offset.y)).rgb * 2.0;
+    sum += texture(source, TexCoords + vec2(0.0, -offset.y * 2.0)).rgb;
+    sum += texture(source, TexCoords + vec2(-offset.x, -offset.y)).rgb * 2.0;
+    FragColor = vec4(sum / 12.0, 1.0);
+}
@@ -0,0 +1,30 @@
+#version 330 core
+// last pass of PostProcess: scene plus bloom, exposure and tonemapping into the default framebuffer
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+uniform sampler2D scene;
+uniform sampler2D bloom;
+uniform float bloomIntensity;
+uniform float exposure;
+uniform int tonemap;  // 0 clamp, 1 Reinhard, 2 ACES (Narkowicz fit)
+
+vec3 ACES(vec3 x)
+{
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+void main()
+{
+    vec3 color = texture(scene, TexCoords).rgb;
+    if (bloomIntensity > 0.0)
+        color += texture(bloom, TexCoords).rgb * bloomIntensity;
+    color *= exposure;
+
+    if (tonemap == 1)
+        color = color / (1.0 + color);
+    else if (tonemap == 2)
+        color = ACES(color);
+    FragColor = vec4(clamp(color, 0.0, 1.0), 1.0);
+}
@@ -0,0 +1,35 @@
+#version 330 core
+// lighting pass of the deferred path, every pixel of the G-buffer is shaded once (see GBuffer).
+// compiled with the light features of lighting.glsl
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 BrightColor;
+
+uniform sampler2D gAlbedoSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProjection;
+
+#include "lighting.glsl"
+#include "bloom.glsl"
+
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, pixel, 0).r;
+    // no surface here, the clear color and the skybox stay
+    if (depth == 1.0)
+        discard;
+
+    vec4 albedoSpecular = texelFetch(gAlbedoSpecular, pixel, 0);
+    vec4 normalShininess = texelFetch(gNormal, pixel, 0);
+    vec2 uv = gl_FragCoord.xy / vec2(textureSize(gDepth, 0));
+    vec4 world = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    vec3 fragPos = world.xyz / world.w;
+
+    vec3 result = CalcLighting(normalize(normalShininess.xyz), fragPos, vec3(gl_FragCoord.xy, depth),
+                               albedoSpecular.rgb, albedoSpecular.a, normalShininess.w);
+    FragColor = vec4(result, 1.0);
+    BrightColor = BrightPart(result);
+    // the scene depth for what is drawn forward afterwards (transparent objects, skybox)
+    gl_FragDepth = depth;
+}
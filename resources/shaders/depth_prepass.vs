@@ -0,0 +1,23 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+#ifdef INSTANCED
+layout (location = 5) in mat4 aModel;
+#endif
+
+#ifndef INSTANCED
+uniform mat4 model;
+#endif
+uniform mat4 view;
+uniform mat4 projection;
+
+// the lit pass tests against this depth with GL_EQUAL, so it has to be computed exactly like in model_lighting.vs
+invariant gl_Position;
+
+void main()
+{
+#ifdef INSTANCED
+    mat4 model = aModel;
+#endif
+    vec3 FragPos = vec3(model * vec4(aPos, 1.0));
+    gl_Position = projection * view * vec4(FragPos, 1.0);
+}
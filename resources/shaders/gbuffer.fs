@@ -0,0 +1,46 @@
+#version 330 core
+// geometry pass of the deferred path, writes the surface instead of shading it (see GBuffer).
+// same material features as model_lighting.fs, without the lights
+layout (location = 0) out vec4 AlbedoSpecular;
+layout (location = 1) out vec4 NormalShininess;
+
+struct Material {
+    sampler2D texture_diffuse1;
+#ifdef HAS_SPECULAR_MAP
+    sampler2D texture_specular1;
+#endif
+#ifdef HAS_NORMAL_MAP
+    sampler2D texture_normal1;
+#endif
+
+    float shininess;
+};
+
+// specular intensity of meshes without a specular map
+const float DEFAULT_SPECULAR = 0.2;
+
+in vec2 TexCoords;
+in vec3 Normal;
+in vec3 FragPos;
+#ifdef HAS_NORMAL_MAP
+in mat3 TBN;
+#endif
+
+uniform Material material;
+
+void main()
+{
+#ifdef HAS_NORMAL_MAP
+    vec3 normal = normalize(TBN * (texture(material.texture_normal1, TexCoords).rgb * 2.0 - 1.0));
+#else
+    vec3 normal = normalize(Normal);
+#endif
+#ifdef HAS_SPECULAR_MAP
+    float specularMask = texture(material.texture_specular1, TexCoords).r;
+#else
+    float specularMask = DEFAULT_SPECULAR;
+#endif
+
+    AlbedoSpecular = vec4(texture(material.texture_diffuse1, TexCoords).rgb, specularMask);
+    NormalShininess = vec4(normal, material.shininess);
+}
@@ -0,0 +1,229 @@
+// lighting shared by model_lighting.fs (forward) and deferred_lighting.fs, included by Shader.
+// compile-time features (see ShaderFeatures):
+//   POINT_LIGHTS=N    the first N point lights of LightBlock are added
+//   SPOTLIGHT         the camera flashlight is added
+//   CLUSTERED         point lights from the cluster of the fragment (LightClusters in light_clusters.h)
+//   SHADOWS           the directional light is shadowed by the cascades of ShadowCascades (shadow_cascades.h)
+
+struct DirLight {
+    vec3 direction;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    vec3 position;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+struct SpotLight {
+    vec3 position;
+    vec3 direction;
+    float cutOff;
+    float outerCutOff;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+// std140 mirror of LightBlockData in main.cpp, bound to LIGHT_BLOCK_BINDING.
+// filled once per frame for every program that uses it. pointLightOn and spotLightOn only keep
+// the layout, the variants are compiled with or without those lights.
+layout (std140) uniform LightBlock {
+    DirLight dirLight;
+    PointLight pointLights[3];
+    SpotLight spotLight;
+    vec3 viewPosition;
+    bool pointLightOn;
+    bool spotLightOn;
+};
+
+#ifdef CLUSTERED
+// buffer textures filled by LightClusters. clusterLightData holds 4 texels per light:
+// (position, radius), (ambient, constant), (diffuse, linear), (specular, quadratic).
+// clusterGrid holds (first index, count) per cluster into clusterLightIndices.
+uniform samplerBuffer clusterLightData;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterLightIndices;
+
+// std140 mirror of ClusterBlockData in light_clusters.h, bound to CLUSTER_BLOCK_BINDING
+layout (std140) uniform ClusterBlock {
+    ivec4 clusterDimensions;
+    vec2 viewportSize;
+    float sliceScale;
+    float sliceBias;
+    float nearPlane;
+    float farPlane;
+};
+
+// index of the cluster at window position fragCoord (x, y in pixels, z the depth buffer value),
+// the same split as LightClusters::Build
+int ClusterIndex(vec3 fragCoord)
+{
+    float ndcDepth = fragCoord.z * 2.0 - 1.0;
+    float viewDepth = 2.0 * nearPlane * farPlane / (farPlane + nearPlane - ndcDepth * (farPlane - nearPlane));
+    ivec2 tile = ivec2(fragCoord.xy / viewportSize * vec2(clusterDimensions.xy));
+    int slice = int(floor(log(viewDepth) * sliceScale + sliceBias));
+    ivec3 cluster = clamp(ivec3(tile, slice), ivec3(0), clusterDimensions.xyz - 1);
+    return (cluster.z * clusterDimensions.y + cluster.y) * clusterDimensions.x + cluster.x;
+}
+#endif
+
+#ifdef SHADOWS
+uniform sampler2DArrayShadow shadowMap;
+
+// std140 mirror of ShadowBlockData in shadow_cascades.h, bound to SHADOW_BLOCK_BINDING
+layout (std140) uniform ShadowBlock {
+    mat4 cascadeMatrices[4];
+    vec4 cascadeSplits;
+    vec4 cascadeTexelSizes;
+    vec4 cameraForward;
+    ivec4 cascadeCount;
+};
+
+// 1 lit, 0 in shadow. The cascade is the first one whose split lies beyond the view depth of
+// fragPos; past the last split everything is lit.
+float DirShadow(vec3 normal, vec3 fragPos)
+{
+    float viewDepth = dot(fragPos - viewPosition, cameraForward.xyz);
+    int cascade = 0;
+    while (cascade < cascadeCount.x && viewDepth > cascadeSplits[cascade])
+        cascade++;
+    if (cascade >= cascadeCount.x)
+        return 1.0;
+
+    // pushed out along the normal by about a texel, against acne on surfaces facing away from the light
+    vec3 offsetPos = fragPos + normal * cascadeTexelSizes[cascade] * 1.5;
+    vec4 shadowPos = cascadeMatrices[cascade] * vec4(offsetPos, 1.0);
+    vec3 coords = shadowPos.xyz / shadowPos.w * 0.5 + 0.5;
+    // casters were clamped onto the near plane, receivers in front of it are lit by it too
+    coords.z = clamp(coords.z, 0.0, 1.0);
+
+    // 3x3 PCF, every tap filtered 2x2 by the comparison sampler
+    vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int x = -1; x <= 1; x++)
+        for (int y = -1; y <= 1; y++)
+            lit += texture(shadowMap, vec4(coords.xy + vec2(x, y) * texel, float(cascade), coords.z));
+    return lit / 9.0;
+}
+#endif
+
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 albedo, float specularMask, float shininess, float shadow)
+{
+    vec3 lightDir = normalize(-light.direction);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularMask;
+    return (ambient + (diffuse + specular) * shadow);
+}
+
+vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float specularMask, float shininess)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading, Blinn Phong
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularMask;
+    ambient *= attenuation;
+    diffuse *= attenuation;
+    specular *= attenuation;
+    return (ambient + diffuse + specular);
+}
+
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, float specularMask, float shininess)
+{
+    vec3 lightDir = normalize(light.position - fragPos);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(normal, halfwayDir), 0.0), shininess);
+    // attenuation
+    float distance = length(light.position - fragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    // spotlight intensity
+    float theta = dot(lightDir, normalize(-light.direction));
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+    // combine results
+    vec3 ambient = light.ambient * albedo;
+    vec3 diffuse = light.diffuse * diff * albedo;
+    vec3 specular = light.specular * spec * specularMask;
+    ambient *= attenuation * intensity;
+    diffuse *= attenuation * intensity;
+    specular *= attenuation * intensity;
+    return (ambient + diffuse + specular);
+}
+
+// every light of the variant at one surface point. fragCoord is the window position and depth
+// buffer value of the point, for finding its cluster.
+vec3 CalcLighting(vec3 normal, vec3 fragPos, vec3 fragCoord, vec3 albedo, float specularMask, float shininess)
+{
+    vec3 viewDir = normalize(viewPosition - fragPos);
+#ifdef SHADOWS
+    float shadow = DirShadow(normal, fragPos);
+#else
+    float shadow = 1.0;
+#endif
+    vec3 result = CalcDirLight(dirLight, normal, viewDir, albedo, specularMask, shininess, shadow);
+
+#if defined(POINT_LIGHTS) && POINT_LIGHTS > 0
+    for(int i = 0; i < POINT_LIGHTS; i++)
+        result += CalcPointLight(pointLights[i], normal, fragPos, viewDir, albedo, specularMask, shininess);
+#endif
+
+#ifdef SPOTLIGHT
+    result += CalcSpotLight(spotLight, normal, fragPos, viewDir, albedo, specularMask, shininess);
+#endif
+
+#ifdef CLUSTERED
+    uvec2 cluster = texelFetch(clusterGrid, ClusterIndex(fragCoord)).rg;
+    for(uint i = 0u; i < cluster.y; i++)
+    {
+        int texel = int(texelFetch(clusterLightIndices, int(cluster.x + i)).r) * 4;
+        vec4 positionRadius = texelFetch(clusterLightData, texel);
+        vec4 ambientConstant = texelFetch(clusterLightData, texel + 1);
+        vec4 diffuseLinear = texelFetch(clusterLightData, texel + 2);
+        vec4 specularQuadratic = texelFetch(clusterLightData, texel + 3);
+        PointLight light = PointLight(positionRadius.xyz, ambientConstant.rgb, diffuseLinear.rgb, specularQuadratic.rgb,
+                                      ambientConstant.a, diffuseLinear.a, specularQuadratic.a);
+        // fades to zero at the radius the light was binned with, so the clusters it is left out of miss nothing
+        float falloff = pow(length(positionRadius.xyz - fragPos) / max(positionRadius.w, 0.0001), 4.0);
+        float window = clamp(1.0 - falloff, 0.0, 1.0);
+        result += CalcPointLight(light, normal, fragPos, viewDir, albedo, specularMask, shininess) * window * window;
+    }
+#endif
+
+    return result;
+}
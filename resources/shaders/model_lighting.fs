@@ -1,146 +1,55 @@
 #version 330 core
+// compile-time features, inserted after #version by Shader (see ShaderFeatures):
+//   HAS_SPECULAR_MAP  specular intensity from texture_specular1, DEFAULT_SPECULAR otherwise
+//   HAS_NORMAL_MAP    normals from texture_normal1 in the tangent space of the vertex shader
+// and the light features of lighting.glsl
 layout (location = 0) out vec4 FragColor;
 layout (location = 1) out vec4 BrightColor;
 
-struct DirLight {
-    vec3 direction;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct PointLight {
-    vec3 position;
-
-    vec3 specular;
-    vec3 diffuse;
-    vec3 ambient;
-
-    float constant;
-    float linear;
-    float quadratic;
-};
-
-struct SpotLight {
-    vec3 position;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
 struct Material {
     sampler2D texture_diffuse1;
+#ifdef HAS_SPECULAR_MAP
     sampler2D texture_specular1;
+#endif
+#ifdef HAS_NORMAL_MAP
+    sampler2D texture_normal1;
+#endif
 
     float shininess;
 };
 
+// specular intensity of meshes without a specular map
+const float DEFAULT_SPECULAR = 0.2;
+
 in vec2 TexCoords;
 in vec3 Normal;
 in vec3 FragPos;
-
-uniform DirLight dirLight;
-
-uniform PointLight pointLight1;
-uniform PointLight pointLight2;
-uniform PointLight pointLight3;
+#ifdef HAS_NORMAL_MAP
+in mat3 TBN;
+#endif
 
 uniform Material material;
 
-uniform SpotLight spotLight;
-
-uniform bool spotLightOn;
-uniform bool pointLightOn;
-
-uniform vec3 viewPosition;
-
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
-{
-    vec3 lightDir = normalize(-light.direction);
-    vec3 halfwayDir = normalize(lightDir + viewDir);
-    // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
-    // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords).xxx);
-    return (ambient + diffuse + specular);
-}
-
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
-{
-    vec3 lightDir = normalize(light.position - fragPos);
-    // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading, Blinn Phong
-    vec3 halfwayDir = normalize(lightDir + viewDir);
-    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
-    // attenuation
-    float distance = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-    // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords).xxx);
-    ambient *= attenuation;
-    diffuse *= attenuation;
-    specular *= attenuation;
-    return (ambient + diffuse + specular);
-}
-
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
-{
-    vec3 lightDir = normalize(light.position - fragPos);
-    vec3 halfwayDir = normalize(lightDir + viewDir);
-    // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
-    // attenuation
-    float distance = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
-    // spotlight intensity
-    float theta = dot(lightDir, normalize(-light.direction));
-    float epsilon = light.cutOff - light.outerCutOff;
-    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
-    // combine results
-    vec3 ambient = light.ambient * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.texture_diffuse1, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.texture_specular1, TexCoords).xxx);
-    ambient *= attenuation * intensity;
-    diffuse *= attenuation * intensity;
-    specular *= attenuation * intensity;
-    return (ambient + diffuse + specular);
-}
+#include "lighting.glsl"
+#include "bloom.glsl"
 
 void main()
 {
+#ifdef HAS_NORMAL_MAP
+    vec3 normal = normalize(TBN * (texture(material.texture_normal1, TexCoords).rgb * 2.0 - 1.0));
+#else
     vec3 normal = normalize(Normal);
-    vec3 viewDir = normalize(viewPosition - FragPos);
+#endif
 
-    vec3 result = CalcDirLight(dirLight, normal, viewDir);
-
-    if(pointLightOn){
-        result += CalcPointLight(pointLight1, normal, FragPos, viewDir);
-        result += CalcPointLight(pointLight2, normal, FragPos, viewDir);
-        result += CalcPointLight(pointLight3, normal, FragPos, viewDir);
-    }
-
-    if(spotLightOn)
-        result += CalcSpotLight(spotLight, normal, FragPos, viewDir);
+    // every texture is fetched once and shared by all lights
+    vec3 albedo = texture(material.texture_diffuse1, TexCoords).rgb;
+#ifdef HAS_SPECULAR_MAP
+    float specularMask = texture(material.texture_specular1, TexCoords).r;
+#else
+    float specularMask = DEFAULT_SPECULAR;
+#endif
 
+    vec3 result = CalcLighting(normal, FragPos, gl_FragCoord.xyz, albedo, specularMask, material.shininess);
     FragColor = vec4(result, 1.0);
-}
\ No newline at end of file
+    BrightColor = BrightPart(result);
+}
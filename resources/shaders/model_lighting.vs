@@ -2,19 +2,41 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+#ifdef HAS_NORMAL_MAP
+layout (location = 3) in vec3 aTangent;
+layout (location = 4) in vec3 aBitangent;
+#endif
+#ifdef INSTANCED
+layout (location = 5) in mat4 aModel;
+#endif
 
 out vec2 TexCoords;
 out vec3 Normal;
 out vec3 FragPos;
+#ifdef HAS_NORMAL_MAP
+out mat3 TBN;
+#endif
 
+#ifndef INSTANCED
 uniform mat4 model;
+#endif
 uniform mat4 view;
 uniform mat4 projection;
 
+// matches the depth pre-pass bit for bit, see depth_prepass.vs
+invariant gl_Position;
+
 void main()
 {
+#ifdef INSTANCED
+    mat4 model = aModel;
+#endif
     FragPos = vec3(model * vec4(aPos, 1.0));
     Normal =  aNormal;
+#ifdef HAS_NORMAL_MAP
+    // tangent space in the same space as Normal
+    TBN = mat3(normalize(aTangent), normalize(aBitangent), normalize(aNormal));
+#endif
     TexCoords = aTexCoords;
     gl_Position = projection * view * vec4(FragPos, 1.0);
-}
\ No newline at end of file
+}
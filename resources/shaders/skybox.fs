@@ -1,11 +1,15 @@
 #version 330 core
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 BrightColor;
 
 in vec3 TexCoords;
 
 uniform samplerCube skybox;
 
+#include "bloom.glsl"
+
 void main()
 {    
     FragColor = texture(skybox, TexCoords);
+    BrightColor = BrightPart(FragColor.rgb);
 }
\ No newline at end of file
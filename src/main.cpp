@@ -10,11 +10,39 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <learnopengl/filesystem.h>
+#include <learnopengl/frame_benchmark.h>
+#include <learnopengl/gbuffer.h>
+#include <learnopengl/geometry_arena.h>
+#include <learnopengl/bvh.h>
+#include <learnopengl/gl_state.h>
+#include <learnopengl/golden_images.h>
+#include <learnopengl/gpu_memory.h>
+#include <learnopengl/gpu_timer.h>
+#include <learnopengl/headless_context.h>
+#include <learnopengl/hiz_culler.h>
+#include <learnopengl/light_clusters.h>
 #include <learnopengl/shader.h>
+#include <learnopengl/shader_variants.h>
 #include <learnopengl/camera.h>
 #include <learnopengl/model.h>
-
+#include <learnopengl/model_loader.h>
+#include <learnopengl/post_process.h>
+#include <learnopengl/profiler.h>
+#include <learnopengl/program_cache.h>
+#include <learnopengl/render_queue.h>
+#include <learnopengl/shadow_cascades.h>
+#include <learnopengl/texture_registry.h>
+#include <learnopengl/texture_service.h>
+#include <learnopengl/uniform_buffer.h>
+#include <learnopengl/thread_pool.h>
+#include <learnopengl/trace_recorder.h>
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <random>
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 
@@ -26,6 +54,14 @@ void processInput(GLFWwindow *window);
 
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
 
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
+
+int runBvhBenchmark();
+
+int runClusterBenchmark();
+
+double currentTime();
+
 unsigned int loadTexture(const char *path);
 
 unsigned int loadCubemap(vector<std::string> faces);
@@ -62,7 +98,67 @@ struct SpotLight {
     glm::vec3 specular;
 };
 
-void setShader(Shader ourShader, DirLight dirLight, PointLight pointLight, SpotLight spotLight);
+// std140 layout of the LightBlock uniform block in model_lighting.fs.
+// vec3 members are padded to 16 bytes, the pad fields must stay zero.
+const unsigned int LIGHT_BLOCK_BINDING = 0;
+const unsigned int POINT_LIGHT_COUNT = 3;
+// shared by the LightBlock and the clustered lights
+const glm::vec3 pointLightPositions[POINT_LIGHT_COUNT] = {
+        glm::vec3(17.0f, 17.0f, -1.0f),
+        glm::vec3(18.0f, 7.0f, 10.0f),
+        glm::vec3(13.0f, 3.5f, 11.0f)
+};
+
+struct DirLightStd140 {
+    glm::vec3 direction; float pad0;
+    glm::vec3 ambient;   float pad1;
+    glm::vec3 diffuse;   float pad2;
+    glm::vec3 specular;  float pad3;
+};
+struct PointLightStd140 {
+    glm::vec3 position;  float pad0;
+    glm::vec3 ambient;   float pad1;
+    glm::vec3 diffuse;   float pad2;
+    glm::vec3 specular;
+    float constant;
+    float linear;
+    float quadratic;
+    float pad3[2];
+};
+struct SpotLightStd140 {
+    glm::vec3 position;  float pad0;
+    glm::vec3 direction;
+    float cutOff;
+    float outerCutOff;
+
+    float constant;
+    float linear;
+    float quadratic;
+
+    glm::vec3 ambient;   float pad1;
+    glm::vec3 diffuse;   float pad2;
+    glm::vec3 specular;  float pad3;
+};
+struct LightBlockData {
+    DirLightStd140 dirLight;
+    PointLightStd140 pointLights[POINT_LIGHT_COUNT];
+    SpotLightStd140 spotLight;
+    glm::vec3 viewPosition;
+    int pointLightOn;
+    int spotLightOn;
+    int pad[3];
+};
+static_assert(sizeof(DirLightStd140) == 64, "std140 DirLight is 64 bytes");
+static_assert(sizeof(PointLightStd140) == 80, "std140 PointLight array stride is 80 bytes");
+static_assert(sizeof(SpotLightStd140) == 96, "std140 SpotLight is 96 bytes");
+static_assert(offsetof(LightBlockData, viewPosition) == 400, "std140 LightBlock.viewPosition is at 400");
+
+// ClusterBlock of model_lighting.fs, see light_clusters.h
+const unsigned int CLUSTER_BLOCK_BINDING = 1;
+// BloomBlock of bloom.glsl, see post_process.h
+const unsigned int BLOOM_BLOCK_BINDING = 2;
+// ShadowBlock of lighting.glsl, see shadow_cascades.h
+const unsigned int SHADOW_BLOCK_BINDING = 3;
 
 
 // settings
@@ -73,6 +169,23 @@ bool spotLightOn = false;
 bool pointLightOn = true;
 bool plKeyPressed = false;
 bool slKeyPressed = false;
+bool frustumCullingOn = true;
+bool occlusionCullingOn = false;
+bool depthPrePassOn = false;
+bool deferredShadingOn = false;
+// off by default so the scene keeps its LDR look, the "Post-process" window turns it on
+bool hdrOn = false;
+PostProcess::Settings postProcessSettings;
+bool shadowsOn = true;
+ShadowCascades::Settings shadowSettings;
+// off by default, --street-lights N or the "Render stats" window turns it on
+bool clusteredLightingOn = false;
+int streetLightCount = 0;
+bool pickRequested = false;
+double pickX = 0.0, pickY = 0.0;
+// F9 writes the next traceFrames frames (and every load event so far) to traceFile, see TraceRecorder
+unsigned int traceFrames = 120;
+std::string traceFile = "trace.json";
 
 // camera
 
@@ -139,59 +252,175 @@ void ProgramState::LoadFromFile(std::string filename) {
 
 ProgramState *programState;
 
-void DrawImGui(ProgramState *programState);
+// per-frame numbers shown in the ImGui windows
+struct FrameStats {
+    RenderQueue::Stats queue;
+    RenderQueue::CullStats culling;
+    unsigned int bvhVisible = 0;
+    unsigned int bvhObjects = 0;
+    const char *nearestObject = "-";
+    float nearestDistance = 0.0f;
+    const char *pickedObject = "-";
+    GLState::Counters state;
+    // GPU time of the scene pass (queue execution and deferred lighting), averaged separately
+    // for forward/deferred and without/with depth pre-pass
+    double sceneGpuMs[2][2] = {{0.0, 0.0}, {0.0, 0.0}};
+    unsigned int shaderVariants = 0;
+    LightClusters::Stats clusters;
+    bool hdr = false;
+    int bloomLevels = 0;
+    PostProcess::Timings post;
+    bool shadows = false;
+    double shadowGpuMs = 0.0;
+    unsigned int shadowCasters = 0;  // packets drawn into all cascades
+};
 
-int main() {
-    // glfw: initialize and configure
-    // ------------------------------
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+void updateLightBlock(UniformBuffer<LightBlockData> &lightBlock, const ProgramState &state);
+
+void updateClusterLights(vector<ClusterLight> &lights, const ProgramState &state, const vector<glm::vec3> &road);
+
+void DrawImGui(ProgramState *programState, const FrameStats &frameStats);
+
+void DrawProfiler();
+
+void DrawGpuMemory();
+
+int main(int argc, char **argv) {
+    // --bench replays a camera path without a window and reports frame times, see FrameBenchmark
+    bool benchmarkMode = false;
+    FrameBenchmark::Settings benchmarkSettings;
+    benchmarkSettings.width = SCR_WIDTH;
+    benchmarkSettings.height = SCR_HEIGHT;
+    // --golden renders fixed poses without a window and compares them with stored pictures, see GoldenImages
+    bool goldenMode = false;
+    GoldenImages::Settings goldenSettings;
+    bool traceRequested = false;
+    // --mem-report prints every GPU allocation once the textures are uploaded, see GpuMemory
+    bool memoryReport = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--bvh-bench")
+            return runBvhBenchmark();
+        if (arg == "--cluster-bench")
+            return runClusterBenchmark();
+        if (arg == "--bench" && hasValue) {
+            benchmarkMode = true;
+            benchmarkSettings.pathFile = argv[++i];
+        } else if ((arg == "--golden" || arg == "--golden-update") && hasValue) {
+            goldenMode = true;
+            goldenSettings.update = arg == "--golden-update";
+            goldenSettings.posesFile = argv[++i];
+        } else if (arg == "--golden-dir" && hasValue) {
+            goldenSettings.directory = argv[++i];
+        } else if (arg == "--frames" && hasValue) {
+            benchmarkSettings.frames = goldenSettings.frames = std::max(atoi(argv[++i]), 1);
+        } else if (arg == "--warmup" && hasValue) {
+            benchmarkSettings.warmup = goldenSettings.warmup = std::max(atoi(argv[++i]), 0);
+        } else if (arg == "--size" && hasValue) {
+            int width = 0, height = 0;
+            if (sscanf(argv[++i], "%dx%d", &width, &height) == 2 && width > 0 && height > 0) {
+                benchmarkSettings.width = width;
+                benchmarkSettings.height = height;
+            }
+        } else if (arg == "--bench-out" && hasValue) {
+            benchmarkSettings.output = argv[++i];
+        } else if (arg == "--trace" && hasValue) {
+            traceRequested = true;
+            traceFrames = (unsigned int)std::max(atoi(argv[++i]), 1);
+        } else if (arg == "--trace-out" && hasValue) {
+            traceFile = argv[++i];
+        } else if (arg == "--street-lights" && hasValue) {
+            streetLightCount = std::min(std::max(atoi(argv[++i]), 0), 1024);
+            clusteredLightingOn = true;
+        } else if (arg == "--mem-report") {
+            memoryReport = true;
+        }
+    }
+    goldenSettings.width = benchmarkSettings.width;
+    goldenSettings.height = benchmarkSettings.height;
+    bool headlessMode = benchmarkMode || goldenMode;
+
+    // --trace N captures the first N frames, the load events before them are recorded anyway
+    TraceRecorder &trace = TraceRecorder::Instance();
+    trace.NameThread("Main thread");
+    if (traceRequested)
+        trace.Capture(traceFrames, traceFile);
+
+    // declared first, so it outlives every GL object of main
+    HeadlessContext headless;
+    FrameBenchmark benchmark(benchmarkSettings);
+    GoldenImages golden(goldenSettings);
+    GLFWwindow *window = nullptr;
+    if (headlessMode) {
+        bool loaded = benchmarkMode ? benchmark.Load() : golden.Load();
+        if (!loaded || !headless.Create(benchmarkSettings.width, benchmarkSettings.height))
+            return -1;
+        if (!gladLoadGLLoader((GLADloadproc) HeadlessContext::GetProcAddress)) {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
+        ProgramCache::Init((GLADloadproc) HeadlessContext::GetProcAddress);
+    } else {
+        // glfw: initialize and configure
+        // ------------------------------
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 #ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
-    // glfw window creation
-    // --------------------
-    GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
-    if (window == NULL) {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
-    }
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
-    glfwSetKeyCallback(window, key_callback);
-    // tell GLFW to capture our mouse
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-
-    // glad: load all OpenGL function pointers
-    // ---------------------------------------
-    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
-        std::cout << "Failed to initialize GLAD" << std::endl;
-        return -1;
+        // glfw window creation
+        // --------------------
+        window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+        if (window == NULL) {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetScrollCallback(window, scroll_callback);
+        glfwSetKeyCallback(window, key_callback);
+        glfwSetMouseButtonCallback(window, mouse_button_callback);
+        // tell GLFW to capture our mouse
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+        // glad: load all OpenGL function pointers
+        // ---------------------------------------
+        if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress)) {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return -1;
+        }
+        // linked programs from earlier runs, see ProgramCache
+        ProgramCache::Init((GLADloadproc) glfwGetProcAddress);
     }
 
     // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
     // stbi_set_flip_vertically_on_load(true);
 
 
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
+    GLState &glState = GLState::Instance();
+    glState.Enable(GL_DEPTH_TEST);
+    glState.Enable(GL_BLEND);
 
     // dodatak
-    glEnable(GL_CULL_FACE);
+    glState.Enable(GL_CULL_FACE);
     glCullFace(GL_BACK);
     glFrontFace(GL_CCW);
     // dodatak
 
     programState = new ProgramState;
-    programState->LoadFromFile("resources/program_state.txt");
-    if (programState->ImGuiEnabled) {
+    // goldens are rendered with the default settings, not with whatever was saved last
+    if (!goldenMode)
+        programState->LoadFromFile("resources/program_state.txt");
+    if (headlessMode) {
+        programState->ImGuiEnabled = false;
+    } else if (programState->ImGuiEnabled) {
         glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_NORMAL);
     }
     // Init Imgui
@@ -202,12 +431,14 @@ int main() {
 
 
 
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
-    ImGui_ImplOpenGL3_Init("#version 330 core");
+    if (!headlessMode) {
+        ImGui_ImplGlfw_InitForOpenGL(window, true);
+        ImGui_ImplOpenGL3_Init("#version 330 core");
+    }
 
     // configure global opengl state
     // -----------------------------
-    glEnable(GL_DEPTH_TEST);
+    glState.Enable(GL_DEPTH_TEST);
     glEnable(GL_MULTISAMPLE);
 
     //light
@@ -244,25 +475,94 @@ int main() {
 
     // build and compile shaders
     // -------------------------
-    Shader ourShader("resources/shaders/model_lighting.vs", "resources/shaders/model_lighting.fs");
+    // the lit model shader is compiled per feature set (lights on, texture maps, instancing) on first use
+    auto setupLights = [](Shader &shader) {
+        shader.BindUniformBlock("LightBlock", LIGHT_BLOCK_BINDING);
+        // only in CLUSTERED variants, the calls do nothing for the others
+        shader.BindUniformBlock("ClusterBlock", CLUSTER_BLOCK_BINDING);
+        shader.setInt("clusterLightData", LightClusters::LightDataUnit);
+        shader.setInt("clusterGrid", LightClusters::GridUnit);
+        shader.setInt("clusterLightIndices", LightClusters::IndexUnit);
+        // threshold of the BrightColor output, see bloom.glsl
+        shader.BindUniformBlock("BloomBlock", BLOOM_BLOCK_BINDING);
+        // only in SHADOWS variants
+        shader.BindUniformBlock("ShadowBlock", SHADOW_BLOCK_BINDING);
+        shader.setInt("shadowMap", ShadowCascades::ShadowUnit);
+    };
+    auto setupMaterial = [](Shader &shader) {
+        shader.setFloat("material.shininess", 32.0f);
+        // diffuse maps are always the first texture of a mesh, packets without a mesh bind theirs there too
+        shader.setInt("material.texture_diffuse1", 0);
+    };
+    ShaderVariants lightingShaders("resources/shaders/model_lighting.vs", "resources/shaders/model_lighting.fs",
+                                   [&](Shader &shader) { setupLights(shader); setupMaterial(shader); });
+    // deferred path: the models write the G-buffer, a full-screen pass does the lighting
+    ShaderVariants gbufferShaders("resources/shaders/model_lighting.vs", "resources/shaders/gbuffer.fs", setupMaterial);
+    ShaderVariants deferredLightingShaders("resources/shaders/fullscreen.vs", "resources/shaders/deferred_lighting.fs",
+                                           [&](Shader &shader) {
+                                               setupLights(shader);
+                                               shader.setInt("gAlbedoSpecular", GBuffer::AlbedoSpecularUnit);
+                                               shader.setInt("gNormal", GBuffer::NormalUnit);
+                                               shader.setInt("gDepth", GBuffer::DepthUnit);
+                                           });
     Shader skyboxShader("resources/shaders/skybox.vs", "resources/shaders/skybox.fs");
     Shader blendingShader("resources/shaders/blending.vs", "resources/shaders/blending.fs");
+    Shader depthShader("resources/shaders/depth_prepass.vs", "resources/shaders/depth_prepass.fs");
+    Shader depthInstancedShader("resources/shaders/depth_prepass.vs", "resources/shaders/depth_prepass.fs", nullptr, {"INSTANCED"});
+    // shadow casters are drawn depth only as well, with their own programs so the pre-pass keeps its camera
+    Shader shadowShader("resources/shaders/depth_prepass.vs", "resources/shaders/depth_prepass.fs");
+    Shader shadowInstancedShader("resources/shaders/depth_prepass.vs", "resources/shaders/depth_prepass.fs", nullptr, {"INSTANCED"});
+    Shader bloomDownsampleShader("resources/shaders/fullscreen.vs", "resources/shaders/bloom_downsample.fs");
+    Shader bloomUpsampleShader("resources/shaders/fullscreen.vs", "resources/shaders/bloom_upsample.fs");
+    Shader compositeShader("resources/shaders/fullscreen.vs", "resources/shaders/composite.fs");
+    skyboxShader.BindUniformBlock("BloomBlock", BLOOM_BLOCK_BINDING);
+    blendingShader.BindUniformBlock("BloomBlock", BLOOM_BLOCK_BINDING);
+
+    // the variants are only built on first use, their cache hits show up in the SHADER::VARIANT lines
+    ProgramCache::Report(std::cout);
+
+    // all light parameters live in one uniform buffer, uploaded at most once per frame
+    UniformBuffer<LightBlockData> lightBlock(LIGHT_BLOCK_BINDING);
+
+    // HDR scene target, bloom and tonemapping
+    PostProcess postProcess(bloomDownsampleShader, bloomUpsampleShader, compositeShader);
+    UniformBuffer<BloomBlockData> bloomBlock(BLOOM_BLOCK_BINDING);
+
+    // with clustered lighting the point lights and streetlights are binned into view space clusters
+    // every frame and each fragment only shades the lights of its cluster
+    LightClusters lightClusters;
+    UniformBuffer<ClusterBlockData> clusterBlock(CLUSTER_BLOCK_BINDING);
+    vector<ClusterLight> clusterLights;
+
+    // the directional light casts shadows through cascaded shadow maps, redrawn every frame
+    ShadowCascades shadowCascades;
+    UniformBuffer<ShadowBlockData> shadowBlock(SHADOW_BLOCK_BINDING);
 
     // load models
     // -----------
+    // all models are parsed in parallel and their textures are decoded in the background,
+    // the GPU uploads happen here on the GL thread
+    double modelLoadStart = currentTime();
+    ThreadPool workers;
+    TextureService textureService(workers);
+    ModelLoader loader(workers);
+
+    Model street, stopSign, speedSign, car;
+    loader.Load(street, "resources/objects/road/10563_RoadSectionStraight_v1-L3.obj");
+    loader.Load(stopSign, "resources/objects/stop-sign/StopSign.obj");
+    loader.Load(speedSign, "resources/objects/speed-limit-sign/10566_Speed Limit Sign (70 MPH)_v2-L3.obj");
+    loader.Load(car, "resources/objects/car/source/AbandonedSnowCar/AbandonedSnowCar.fbx");
+    loader.Finish();
 
-    Model street("resources/objects/road/10563_RoadSectionStraight_v1-L3.obj");
     street.SetShaderTextureNamePrefix("material.");
-
-    Model stopSign("resources/objects/stop-sign/StopSign.obj");
     stopSign.SetShaderTextureNamePrefix("material.");
-
-    Model speedSign("resources/objects/speed-limit-sign/10566_Speed Limit Sign (70 MPH)_v2-L3.obj");
     speedSign.SetShaderTextureNamePrefix("material.");
-
-    Model car("resources/objects/car/source/AbandonedSnowCar/AbandonedSnowCar.fbx");
     car.SetShaderTextureNamePrefix("material.");
 
+    std::cout << "SCENE::LOAD models " << (currentTime() - modelLoadStart) * 1000.0
+              << " ms on " << workers.Size() << " threads (mesh cache "
+              << (MeshCache::Enabled() ? "on" : "off") << ")" << std::endl;
+
     vector<glm::vec3> streetPositions {
             glm::vec3(16.0f,5.0f,10.0f),
             glm::vec3(16.0f,6.75f,8.25f),
@@ -276,20 +576,45 @@ int main() {
 
     };
 
-    float vertices[] = {
-            // positions          // colors           // texture coords
-            0.5f,  0.5f, 0.0f,   1.0f, 0.0f, 0.0f,   0.0f, 0.0f, // top right
-            0.5f, -0.5f, 0.0f,   0.0f, 1.0f, 0.0f,   0.0f, 1.0f, // bottom right
-            -0.5f, -0.5f, 0.0f,   0.0f, 0.0f, 1.0f,   1.0f, 1.0f, // bottom left
-            -0.5f,  0.5f, 0.0f,   1.0f, 1.0f, 0.0f,   1.0f, 0.0f  // top left
-    };
-
+    // the road sections never move, their model matrices are built once and drawn instanced
+    vector<glm::mat4> streetModels;
+    for (const glm::vec3 &position : streetPositions) {
+        glm::mat4 modelStreet = glm::mat4(1.0f);
+        modelStreet = glm::translate(modelStreet, position);
+        modelStreet = glm::scale(modelStreet, glm::vec3(0.008f));
+        modelStreet = glm::rotate(modelStreet, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+        modelStreet = glm::rotate(modelStreet, glm::radians(45.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        streetModels.push_back(modelStreet);
+    }
 
-    unsigned int indices[] = {
+    // parking quad, kept in the Vertex layout so it can share the arena with the models.
+    // the old per-vertex colors stay in the normal slot, that is what the lighting shader always read there.
+    vector<Vertex> parkingVertices(4);
+    parkingVertices[0].Position = glm::vec3( 0.5f,  0.5f, 0.0f); parkingVertices[0].Normal = glm::vec3(1.0f, 0.0f, 0.0f); parkingVertices[0].TexCoords = glm::vec2(0.0f, 0.0f); // top right
+    parkingVertices[1].Position = glm::vec3( 0.5f, -0.5f, 0.0f); parkingVertices[1].Normal = glm::vec3(0.0f, 1.0f, 0.0f); parkingVertices[1].TexCoords = glm::vec2(0.0f, 1.0f); // bottom right
+    parkingVertices[2].Position = glm::vec3(-0.5f, -0.5f, 0.0f); parkingVertices[2].Normal = glm::vec3(0.0f, 0.0f, 1.0f); parkingVertices[2].TexCoords = glm::vec2(1.0f, 1.0f); // bottom left
+    parkingVertices[3].Position = glm::vec3(-0.5f,  0.5f, 0.0f); parkingVertices[3].Normal = glm::vec3(1.0f, 1.0f, 0.0f); parkingVertices[3].TexCoords = glm::vec2(1.0f, 0.0f); // top left
+    for (Vertex &vertex : parkingVertices)
+        vertex.Tangent = vertex.Bitangent = glm::vec3(0.0f);
+
+    AABB parkingBounds;
+    for (const Vertex &vertex : parkingVertices)
+        parkingBounds.Expand(vertex.Position);
+
+    vector<unsigned int> parkingIndices {
             0, 1, 3, // first triangle
             1, 2, 3  // second triangle
     };
 
+    // all static geometry shares one vertex and one index buffer, bound once per frame for the lit pass
+    GeometryArena sceneGeometry;
+    ArenaRange parkingRange = sceneGeometry.Add(parkingVertices, parkingIndices);
+    street.MoveToArena(sceneGeometry);
+    stopSign.MoveToArena(sceneGeometry);
+    speedSign.MoveToArena(sceneGeometry);
+    car.MoveToArena(sceneGeometry);
+    sceneGeometry.Build();
+
     float transparentVertices[] = {
             // positions         // texture Coords
             0.0f,  0.5f,  0.0f,  0.0f,  1.0f,
@@ -349,46 +674,33 @@ int main() {
             1.0f, -1.0f,  1.0f
     };
 
-    // parking VAO
-    // ----------------------------------------------------------
-    unsigned int VBO, VAO, EBO;
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
-
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-    glEnableVertexAttribArray(2);
+    AABB transparentBounds;
+    transparentBounds.Expand(glm::vec3(0.0f, -0.5f, 0.0f));
+    transparentBounds.Expand(glm::vec3(1.0f, 0.5f, 0.0f));
 
     // transparent VAO
     unsigned int transparentVAO, transparentVBO;
     glGenVertexArrays(1, &transparentVAO);
     glGenBuffers(1, &transparentVBO);
-    glBindVertexArray(transparentVAO);
+    glState.BindVertexArray(transparentVAO);
     glBindBuffer(GL_ARRAY_BUFFER, transparentVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(transparentVertices), transparentVertices, GL_STATIC_DRAW);
+    GpuMemory::Instance().TrackBuffer(transparentVBO, sizeof(transparentVertices), GpuMemory::Geometry, "Grass quad");
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-    glBindVertexArray(0);
+    glState.BindVertexArray(0);
 
     // skybox VAO
     // --------------------------------------------------------
     unsigned int skyboxVAO, skyboxVBO;
     glGenVertexArrays(1, &skyboxVAO);
     glGenBuffers(1, &skyboxVBO);
-    glBindVertexArray(skyboxVAO);
+    glState.BindVertexArray(skyboxVAO);
     glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+    GpuMemory::Instance().TrackBuffer(skyboxVBO, sizeof(skyboxVertices), GpuMemory::Geometry, "Skybox cube");
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
 
@@ -422,139 +734,523 @@ int main() {
                     glm::vec3(13.0f, 6.4f, 9.3f) // speed sign
             };
 
+    // uniforms set for every object, resolved once
+    Shader::Uniform blendingModel = blendingShader.GetUniform("model");
+    Shader::Uniform blendingView = blendingShader.GetUniform("view");
+    Shader::Uniform blendingProjection = blendingShader.GetUniform("projection");
+    Shader::Uniform depthView = depthShader.GetUniform("view");
+    Shader::Uniform depthProjection = depthShader.GetUniform("projection");
+    Shader::Uniform depthInstancedView = depthInstancedShader.GetUniform("view");
+    Shader::Uniform shadowModel = shadowShader.GetUniform("model");
+    Shader::Uniform shadowView = shadowShader.GetUniform("view");
+    Shader::Uniform shadowProjection = shadowShader.GetUniform("projection");
+    Shader::Uniform shadowInstancedView = shadowInstancedShader.GetUniform("view");
+    Shader::Uniform shadowInstancedProjection = shadowInstancedShader.GetUniform("projection");
+    Shader::Uniform depthInstancedProjection = depthInstancedShader.GetUniform("projection");
+    Shader::Uniform skyboxView = skyboxShader.GetUniform("view");
+    Shader::Uniform skyboxProjection = skyboxShader.GetUniform("projection");
+
+    // the rest of the scene doesn't move either
+    glm::mat4 modelParking = glm::mat4(1.0f);
+    modelParking = glm::translate(modelParking, glm::vec3(18.0f, 18.0f, -2.5f));
+    modelParking = glm::scale(modelParking, glm::vec3(0.6f));
+
+    glm::mat4 modelStopSign = glm::mat4(1.0f);
+    modelStopSign = glm::translate(modelStopSign, glm::vec3(18.75f,7.6f,8.0f));
+    modelStopSign = glm::scale(modelStopSign, glm::vec3(0.3f));
+    modelStopSign = glm::rotate(modelStopSign, glm::radians(105.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+    modelStopSign = glm::rotate(modelStopSign, glm::radians(30.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+
+    glm::mat4 modelSpeedSign = glm::mat4(1.0f);
+    modelSpeedSign = glm::translate(modelSpeedSign, glm::vec3(13.2f,5.8f,9.0f));
+    modelSpeedSign = glm::scale(modelSpeedSign, glm::vec3(0.008f));
+    modelSpeedSign = glm::rotate(modelSpeedSign, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+    modelSpeedSign = glm::rotate(modelSpeedSign, glm::radians(75.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    modelSpeedSign = glm::rotate(modelSpeedSign, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+
+    glm::mat4 modelCar = glm::mat4(1.0f);
+    modelCar = glm::translate(modelCar, glm::vec3(16.3f,15.0f,1.75f));
+    modelCar = glm::rotate(modelCar, glm::radians(20.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+    modelCar = glm::rotate(modelCar, glm::radians(30.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+    modelCar = glm::rotate(modelCar, glm::radians(20.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+    modelCar = glm::scale(modelCar, glm::vec3(0.6f));
+
+    vector<glm::mat4> vegetationModels;
+    for (const glm::vec3 &position : vegetation) {
+        glm::mat4 modelVegetation = glm::mat4(1.0f);
+        modelVegetation = glm::translate(modelVegetation, position);
+        modelVegetation = glm::scale(modelVegetation, glm::vec3(0.65f));
+        vegetationModels.push_back(modelVegetation);
+    }
+
+    // every placed object with its world bounds, in a BVH for frustum culling, picking and
+    // nearest-object queries. The road sections come first, in the order of streetModels.
+    vector<std::string> placementNames;
+    vector<AABB> placementBounds;
+    for (unsigned int i = 0; i < streetModels.size(); i++) {
+        placementNames.push_back("road section " + std::to_string(i + 1));
+        placementBounds.push_back(street.Bounds.Transformed(streetModels[i]));
+    }
+    const unsigned int stopSignPlacement = (unsigned int) placementBounds.size();
+    placementNames.push_back("stop sign");
+    placementBounds.push_back(stopSign.Bounds.Transformed(modelStopSign));
+    const unsigned int speedSignPlacement = (unsigned int) placementBounds.size();
+    placementNames.push_back("speed limit sign");
+    placementBounds.push_back(speedSign.Bounds.Transformed(modelSpeedSign));
+    const unsigned int carPlacement = (unsigned int) placementBounds.size();
+    placementNames.push_back("car");
+    placementBounds.push_back(car.Bounds.Transformed(modelCar));
+    const unsigned int parkingPlacement = (unsigned int) placementBounds.size();
+    placementNames.push_back("parking sign");
+    placementBounds.push_back(parkingBounds.Transformed(modelParking));
+    const unsigned int firstGrassPlacement = (unsigned int) placementBounds.size();
+    for (unsigned int i = 0; i < vegetationModels.size(); i++) {
+        placementNames.push_back("grass " + std::to_string(i + 1));
+        placementBounds.push_back(transparentBounds.Transformed(vegetationModels[i]));
+    }
+    BVH sceneBVH;
+    sceneBVH.Build(placementBounds);
+    int pickedObject = -1;
+    // placements the BVH finds in the view frustum this frame, only those are submitted
+    vector<unsigned int> bvhVisible;
+    vector<bool> placementInView;
+    vector<glm::mat4> visibleStreetModels;
+
+    RenderQueue renderQueue;
+    HiZCuller occlusionCuller;
+    // [0] without, [1] with depth pre-pass; only the one for the current mode runs in a frame
+    GpuTimer sceneTimers[2][2];
+    // casters of one cascade at a time, culled against the volume the cascade covers
+    RenderQueue shadowQueue;
+    GpuTimer shadowTimer;
+    GBuffer gbuffer;
+    // the full-screen triangle of the deferred lighting pass has no vertex data
+    unsigned int fullscreenVAO;
+    glGenVertexArrays(1, &fullscreenVAO);
+    FrameStats frameStats;
+    bool texturesReported = false;
+    // benchmark and golden frames all see the final textures, not the placeholders of the background decoding
+    if (headlessMode)
+        textureService.Finish();
+
     // render loop
     // -----------
-    while (!glfwWindowShouldClose(window)) {
+    Profiler &profiler = Profiler::Instance();
+    while (benchmarkMode ? !benchmark.Done() : goldenMode ? !golden.Done() : !glfwWindowShouldClose(window)) {
+        profiler.BeginFrame();
+        if (trace.CaptureComplete())
+            trace.Write();
         // per-frame time logic
         // --------------------
-        float currentFrame = glfwGetTime();
+        float currentFrame = currentTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
         // input
         // -----
-        processInput(window);
+        if (benchmarkMode)
+            benchmark.BeginFrame(programState->camera);
+        else if (goldenMode)
+            golden.BeginFrame(programState->camera);
+        else
+            processInput(window);
+
+        // textures that finished decoding replace their placeholders
+        {
+            PROFILE_ZONE("Texture uploads");
+            textureService.Update();
+            if (!texturesReported && textureService.Pending() == 0) {
+                TextureRegistry::Instance().Report(std::cout);
+                if (memoryReport)
+                    GpuMemory::Instance().Report(std::cout);
+                texturesReported = true;
+            }
+        }
 
 
         // render
         // ------
-        glClearColor(programState->clearColor.r, programState->clearColor.g, programState->clearColor.b, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        int framebufferWidth = headless.Width(), framebufferHeight = headless.Height();
+        if (!headlessMode)
+            glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+        // a minimized window has no size, the projection keeps the default aspect then
+        float aspect = framebufferWidth > 0 && framebufferHeight > 0 ? (float) framebufferWidth / framebufferHeight
+                                                                     : (float) SCR_WIDTH / (float) SCR_HEIGHT;
+        // with HDR the scene goes into the float target of postProcess, Finish brings it to the screen
+        postProcess.settings = postProcessSettings;
+        bool hdr = hdrOn && postProcess.Resize(framebufferWidth, framebufferHeight);
+        if (hdr) {
+            bloomBlock.Update(postProcess.BlockData());
+            postProcess.BeginScene(programState->clearColor);
+        } else {
+            glClearColor(programState->clearColor.r, programState->clearColor.g, programState->clearColor.b, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
 
 
-        setShader(ourShader, dirLight, pointLight, spotLight);
+        updateLightBlock(lightBlock, *programState);
 
-        glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
+        glm::mat4 projection = glm::perspective(glm::radians(programState->camera.Zoom), aspect, 0.1f, 100.0f);
         glm::mat4 view = programState->camera.GetViewMatrix();
-        ourShader.setMat4("projection", projection);
-        ourShader.setMat4("view", view);
-
-        glDisable(GL_CULL_FACE);
+        blendingShader.use();
+        blendingShader.setMat4(blendingProjection, projection);
+        blendingShader.setMat4(blendingView, view);
+        if (depthPrePassOn) {
+            depthShader.use();
+            depthShader.setMat4(depthView, view);
+            depthShader.setMat4(depthProjection, projection);
+            depthInstancedShader.use();
+            depthInstancedShader.setMat4(depthInstancedView, view);
+            depthInstancedShader.setMat4(depthInstancedProjection, projection);
+        }
 
-        ourShader.use();
-        glBindTexture(GL_TEXTURE_2D, parkingTexture);
-        glm::mat4 model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(18.0f, 18.0f, -2.5f));
-        model = glm::scale(model, glm::vec3(0.6f));
-        ourShader.setMat4("model", model);
-        ourShader.setMat4("view", view);
-        ourShader.setMat4("projection", projection);
-        glad_glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        // scene queries: object under the cursor after a click and the closest object
+        {
+            PROFILE_ZONE("Scene queries");
+            if (pickRequested) {
+                pickRequested = false;
+                int width, height;
+                glfwGetWindowSize(window, &width, &height);
+                glm::vec2 ndc(2.0f * (float) pickX / width - 1.0f, 1.0f - 2.0f * (float) pickY / height);
+                glm::mat4 inverseViewProjection = glm::inverse(projection * view);
+                glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+                glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+                glm::vec3 rayOrigin = glm::vec3(nearPoint) / nearPoint.w;
+                glm::vec3 rayEnd = glm::vec3(farPoint) / farPoint.w;
+                // the ray spans exactly the depth range, so only hits up to distance 1 count
+                pickedObject = sceneBVH.Raycast(rayOrigin, rayEnd - rayOrigin, 1.0f).item;
+            }
+            BVH::Hit nearest = sceneBVH.Nearest(programState->camera.Position);
+            frameStats.nearestObject = nearest.item >= 0 ? placementNames[nearest.item].c_str() : "-";
+            frameStats.nearestDistance = nearest.distance;
+            frameStats.pickedObject = pickedObject >= 0 ? placementNames[pickedObject].c_str() : "-";
+        }
 
-        glEnable(GL_CULL_FACE);
+        // every object in view goes into the render queue, which sorts the draws by state before
+        // issuing them. The placements are culled by the BVH, the queue only tests their meshes.
+        renderQueue.Clear();
+        renderQueue.SetViewer(programState->camera.Position);
+        placementInView.assign(sceneBVH.ItemCount(), !frustumCullingOn);
+        if (frustumCullingOn) {
+            PROFILE_ZONE("BVH culling");
+            Frustum viewFrustum = Frustum::FromMatrix(projection * view);
+            bvhVisible.clear();
+            sceneBVH.QueryFrustum(viewFrustum, bvhVisible);
+            for (unsigned int item : bvhVisible)
+                placementInView[item] = true;
+            renderQueue.SetFrustum(viewFrustum, true);
+            renderQueue.AddCulled(sceneBVH.ItemCount() - (unsigned int) bvhVisible.size());
+        } else {
+            renderQueue.DisableCulling();
+        }
+        frameStats.bvhVisible = frustumCullingOn ? (unsigned int) bvhVisible.size() : sceneBVH.ItemCount();
+        frameStats.bvhObjects = sceneBVH.ItemCount();
+        visibleStreetModels.clear();
+        for (unsigned int i = 0; i < streetModels.size(); i++)
+            if (placementInView[i])
+                visibleStreetModels.push_back(streetModels[i]);
+        occlusionCuller.Update();
+        renderQueue.SetOcclusion(occlusionCullingOn ? &occlusionCuller : nullptr);
+        if (depthPrePassOn)
+            renderQueue.EnableDepthPrePass(depthShader, depthInstancedShader, &sceneGeometry);
+        else
+            renderQueue.DisableDepthPrePass();
+
+        // lights that are off are compiled out of the variants instead of skipped at runtime
+        ShaderFeatures lighting;
+        lighting.pointLights = pointLightOn && !clusteredLightingOn ? POINT_LIGHT_COUNT : 0;
+        lighting.clustered = pointLightOn && clusteredLightingOn;
+        lighting.spotLight = spotLightOn;
+        lighting.shadows = shadowsOn;
+        frameStats.clusters = LightClusters::Stats();
+        if (lighting.clustered) {
+            PROFILE_ZONE("Light clusters");
+            updateClusterLights(clusterLights, *programState, streetPositions);
+            lightClusters.Build(view, projection, 0.1f, 100.0f, clusterLights);
+            lightClusters.Upload();
+            lightClusters.Bind();
+            clusterBlock.Update(lightClusters.BlockData(framebufferWidth, framebufferHeight));
+            frameStats.clusters = lightClusters.LastStats();
+        }
 
-        ourShader.use();
-        glm::mat4 modelStreet = glm::mat4(1.0f);
-        for(int i=0; i<streetPositions.size(); i++) {
-            ourShader.use();
-            modelStreet = glm::mat4(1.0f);
-            modelStreet = glm::translate(modelStreet, streetPositions[i]);
-            modelStreet = glm::scale(modelStreet, glm::vec3(0.008f));
-            modelStreet = glm::rotate(modelStreet, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-            modelStreet = glm::rotate(modelStreet, glm::radians(45.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-            ourShader.setMat4("model", modelStreet);
-            street.Draw(ourShader);
+        // shadow maps before the scene, the casters are the opaque models
+        frameStats.shadows = lighting.shadows;
+        frameStats.shadowCasters = 0;
+        if (lighting.shadows) {
+            PROFILE_GPU_ZONE("Shadow maps");
+            shadowCascades.settings = shadowSettings;
+            shadowCascades.Update(view, glm::radians(programState->camera.Zoom), aspect, 0.1f, programState->dirLight.direction);
+            shadowTimer.Begin();
+            for (int cascade = 0; cascade < shadowCascades.Count(); cascade++) {
+                PROFILE_GPU_ZONE("Shadow cascade");
+                shadowQueue.Clear();
+                shadowQueue.SetViewer(programState->camera.Position);
+                shadowQueue.SetFrustum(shadowCascades.CasterFrustum(cascade));
+
+                DrawPacket parkingCaster;
+                parkingCaster.shader = &shadowShader;
+                parkingCaster.VAO = sceneGeometry.PositionVAO();
+                parkingCaster.indexed = true;
+                parkingCaster.range = parkingRange;
+                parkingCaster.hasModel = true;
+                parkingCaster.modelUniform = shadowModel;
+                parkingCaster.model = modelParking;
+                parkingCaster.cullFace = false;
+                parkingCaster.hasBounds = true;
+                parkingCaster.bounds = parkingBounds.Transformed(parkingCaster.model);
+                shadowQueue.Submit(parkingCaster);
+                shadowQueue.SubmitInstanced(street, shadowInstancedShader, streetModels);
+                shadowQueue.Submit(stopSign, shadowShader, shadowModel, modelStopSign);
+                shadowQueue.Submit(speedSign, shadowShader, shadowModel, modelSpeedSign);
+                shadowQueue.Submit(car, shadowShader, shadowModel, modelCar);
+
+                shadowShader.use();
+                shadowShader.setMat4(shadowView, shadowCascades.View(cascade));
+                shadowShader.setMat4(shadowProjection, shadowCascades.Projection(cascade));
+                shadowInstancedShader.use();
+                shadowInstancedShader.setMat4(shadowInstancedView, shadowCascades.View(cascade));
+                shadowInstancedShader.setMat4(shadowInstancedProjection, shadowCascades.Projection(cascade));
+                shadowCascades.BeginCascade(cascade);
+                shadowQueue.Execute();
+                frameStats.shadowCasters += shadowQueue.LastStats().packets;
+            }
+            shadowCascades.End(hdr ? postProcess.SceneFramebuffer() : 0, framebufferWidth, framebufferHeight);
+            shadowTimer.End();
+            shadowCascades.Bind();
+            shadowBlock.Update(shadowCascades.BlockData());
         }
+        frameStats.shadowGpuMs = shadowTimer.AverageMilliseconds();
 
-        ourShader.use();
-        glm::mat4 modelStopSign = glm::mat4(1.0f);
-        modelStopSign = glm::translate(modelStopSign, glm::vec3(18.75f,7.6f,8.0f));
-        modelStopSign = glm::scale(modelStopSign, glm::vec3(0.3f));
-        modelStopSign = glm::rotate(modelStopSign, glm::radians(105.0f), glm::vec3(0.0f, -1.0f, 0.0f));
-        modelStopSign = glm::rotate(modelStopSign, glm::radians(30.0f), glm::vec3(0.0f, 0.0f, -1.0f));
-        ourShader.setMat4("model", modelStopSign);
-        stopSign.Draw(ourShader);
-
-        ourShader.use();
-        glm::mat4 modelSpeedSign = glm::mat4(1.0f);
-        modelSpeedSign = glm::translate(modelSpeedSign, glm::vec3(13.2f,5.8f,9.0f));
-        modelSpeedSign = glm::scale(modelSpeedSign, glm::vec3(0.008f));
-        modelSpeedSign = glm::rotate(modelSpeedSign, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-        modelSpeedSign = glm::rotate(modelSpeedSign, glm::radians(75.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-        modelSpeedSign = glm::rotate(modelSpeedSign, glm::radians(90.0f), glm::vec3(0.0f, 0.0f, -1.0f));
-        ourShader.setMat4("model", modelSpeedSign);
-        speedSign.Draw(ourShader);
-
-        ourShader.use();
-        glm::mat4 modelCar = glm::mat4(1.0f);
-        modelCar = glm::translate(modelCar, glm::vec3(16.3f,15.0f,1.75f));
-        modelCar = glm::rotate(modelCar, glm::radians(20.0f), glm::vec3(0.0f, -1.0f, 0.0f));
-        modelCar = glm::rotate(modelCar, glm::radians(30.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-        modelCar = glm::rotate(modelCar, glm::radians(20.0f), glm::vec3(0.0f, 0.0f, -1.0f));
-        modelCar = glm::scale(modelCar, glm::vec3(0.6f));
-        ourShader.setMat4("model", modelCar);
-        car.Draw(ourShader);
-
-        glDisable(GL_CULL_FACE);
+        // deferred, the models only write their surface (material features without lights) into the
+        // G-buffer and every pixel is lit once afterwards
+        bool deferred = deferredShadingOn && gbuffer.Resize(framebufferWidth, framebufferHeight);
+        ShaderFeatures surface;
+        ShaderVariants &modelShaders = deferred ? gbufferShaders : lightingShaders;
+        const ShaderFeatures &modelFeatures = deferred ? surface : lighting;
 
+        {
+            PROFILE_ZONE("Submit");
+            ShaderVariants::Variant &parkingShader = modelShaders.Get(modelFeatures);
+            DrawPacket parking;
+            parking.shader = &parkingShader.shader;
+            parking.VAO = sceneGeometry.VAO();
+            parking.texture = parkingTexture;
+            parking.indexed = true;
+            parking.range = parkingRange;
+            parking.hasModel = true;
+            parking.modelUniform = parkingShader.model;
+            parking.model = modelParking;
+            parking.cullFace = false;
+            parking.depth = glm::length(glm::vec3(parking.model[3]) - programState->camera.Position);
+            parking.hasBounds = true;
+            parking.bounds = placementBounds[parkingPlacement];
+            if (placementInView[parkingPlacement])
+                renderQueue.Submit(parking);
+
+            renderQueue.SubmitInstanced(street, modelShaders, modelFeatures, visibleStreetModels);
+
+            if (placementInView[stopSignPlacement])
+                renderQueue.Submit(stopSign, modelShaders, modelFeatures, modelStopSign);
+
+            if (placementInView[speedSignPlacement])
+                renderQueue.Submit(speedSign, modelShaders, modelFeatures, modelSpeedSign);
+
+            if (placementInView[carPlacement])
+                renderQueue.Submit(car, modelShaders, modelFeatures, modelCar);
+
+            for (unsigned int i = 0; i < vegetation.size(); i++) {
+                if (!placementInView[firstGrassPlacement + i])
+                    continue;
+                DrawPacket quad;
+                quad.shader = &blendingShader;
+                quad.VAO = transparentVAO;
+                quad.texture = transparentTexture;
+                quad.vertexCount = 6;
+                quad.hasModel = true;
+                quad.modelUniform = blendingModel;
+                quad.model = vegetationModels[i];
+                quad.cullFace = false;
+                quad.transparent = true;
+                quad.depth = glm::length(vegetation[i] - programState->camera.Position);
+                quad.hasBounds = true;
+                quad.bounds = placementBounds[firstGrassPlacement + i];
+                renderQueue.Submit(quad);
+            }
+
+            // after submission, which may have compiled new variants
+            auto setCamera = [&view, &projection](ShaderVariants::Variant &variant) {
+                variant.shader.use();
+                variant.shader.setMat4(variant.view, view);
+                variant.shader.setMat4(variant.projection, projection);
+            };
+            modelShaders.ForEach(setCamera);
+        }
 
-        blendingShader.use();
-        glBindVertexArray(transparentVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, transparentTexture);
-
-        projection = glm::perspective(glm::radians(programState->camera.Zoom),
-                                      (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
-        view = programState->camera.GetViewMatrix();
-
-        blendingShader.setMat4("projection", projection);
-        blendingShader.setMat4("view", view);
-
-        for (unsigned int i = 0; i < vegetation.size(); i++) {
-            model = glm::mat4(1.0f);
-            model = glm::translate(model, vegetation[i]);
-            model = glm::scale(model, glm::vec3(0.65f));
-            blendingShader.setMat4("model", model);
-            glDrawArrays(GL_TRIANGLES, 0, 6);
+        GpuTimer &sceneTimer = sceneTimers[deferred][depthPrePassOn];
+        {
+            PROFILE_GPU_ZONE("Scene pass");
+            sceneTimer.Begin();
+            if (deferred) {
+                {
+                    PROFILE_GPU_ZONE("G-buffer");
+                    glState.Disable(GL_BLEND);
+                    gbuffer.BeginGeometryPass();
+                    renderQueue.Execute(RenderQueue::Pass::Opaque);
+                    gbuffer.EndGeometryPass(hdr ? postProcess.SceneFramebuffer() : 0);
+                    glState.Enable(GL_BLEND);
+                }
+
+                // lighting writes the G-buffer depth as well, for the transparent objects and the skybox
+                {
+                    PROFILE_GPU_ZONE("Deferred lighting");
+                    ShaderVariants::Variant &deferredLighting = deferredLightingShaders.Get(lighting);
+                    deferredLighting.shader.use();
+                    deferredLighting.shader.setMat4("inverseViewProjection", glm::inverse(projection * view));
+                    gbuffer.BindTextures();
+                    glState.DepthFunc(GL_ALWAYS);
+                    glState.Disable(GL_CULL_FACE);
+                    glState.BindVertexArray(fullscreenVAO);
+                    glDrawArrays(GL_TRIANGLES, 0, 3);
+                    glState.DepthFunc(GL_LESS);
+                }
+
+                PROFILE_GPU_ZONE("Transparent");
+                renderQueue.Execute(RenderQueue::Pass::Transparent);
+            } else {
+                PROFILE_GPU_ZONE("Forward");
+                renderQueue.Execute();
+            }
+            sceneTimer.End();
         }
+        for (int path = 0; path < 2; path++)
+            for (int prePass = 0; prePass < 2; prePass++)
+                frameStats.sceneGpuMs[path][prePass] = sceneTimers[path][prePass].AverageMilliseconds();
+        frameStats.queue = renderQueue.LastStats();
+        frameStats.shaderVariants = (unsigned int) (lightingShaders.Count() + gbufferShaders.Count() + deferredLightingShaders.Count());
+        frameStats.culling = renderQueue.LastCullStats();
+
+        // depth of this frame becomes the occluder for the frame after next
+        if (occlusionCullingOn) {
+            PROFILE_GPU_ZONE("Hi-Z capture");
+            occlusionCuller.Capture(projection * view, framebufferWidth, framebufferHeight);
+        }
+
+        glState.Disable(GL_CULL_FACE);
 
         // draw skybox
         // -------------------------------------------------------------------
-        glDepthMask(GL_FALSE);
-        glDepthFunc(GL_LEQUAL);
-        skyboxShader.use();
-        view = glm::mat4(glm::mat3(programState->camera.GetViewMatrix()));
-        skyboxShader.setMat4("view", view);
-        skyboxShader.setMat4("projection", projection);
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, programState->cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        glDepthMask(GL_TRUE);
-        glDepthFunc(GL_LESS);
+        {
+            PROFILE_GPU_ZONE("Skybox");
+            glState.DepthMask(false);
+            glState.DepthFunc(GL_LEQUAL);
+            skyboxShader.use();
+            view = glm::mat4(glm::mat3(programState->camera.GetViewMatrix()));
+            skyboxShader.setMat4(skyboxView, view);
+            skyboxShader.setMat4(skyboxProjection, projection);
+            glState.BindVertexArray(skyboxVAO);
+            glState.BindTexture(0, GL_TEXTURE_CUBE_MAP, programState->cubemapTexture);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            glState.DepthMask(true);
+            glState.DepthFunc(GL_LESS);
+        }
+
+        if (hdr) {
+            PROFILE_GPU_ZONE("Post-process");
+            postProcess.Finish();
+        }
+        frameStats.hdr = hdr;
+        frameStats.bloomLevels = postProcess.LevelCount();
+        frameStats.post = postProcess.LastTimings();
 
+        frameStats.state = glState.FrameCounters();
+        glState.ResetCounters();
 
 
 
-        if (programState->ImGuiEnabled)
-            DrawImGui(programState);
+
+        if (programState->ImGuiEnabled) {
+            PROFILE_GPU_ZONE("ImGui");
+            DrawImGui(programState, frameStats);
+        }
+
+        if (headlessMode) {
+            if (goldenMode)
+                golden.EndFrame();
+            headless.SwapBuffers();
+            profiler.EndFrame();
+            if (benchmarkMode)
+                benchmark.EndFrame();
+            continue;
+        }
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        {
+            PROFILE_ZONE("Swap");
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+        }
+        profiler.EndFrame();
+    }
+
+    for (int path = 0; path < 2; path++)
+        std::cout << "DEPTH_PREPASS::GPU " << (path ? "deferred" : "forward") << " scene pass "
+                  << sceneTimers[path][0].AverageMilliseconds() << " ms without, " << sceneTimers[path][1].AverageMilliseconds()
+                  << " ms with pre-pass (0 = mode not used)" << std::endl;
+
+    // the scene goes first, whatever of it is still in the GpuMemory book afterwards was never freed
+    for (Model *model : {&street, &stopSign, &speedSign, &car})
+        model->Release();
+    sceneGeometry.Release();
+    TextureRegistry::Instance().Release(parkingTexture);
+    TextureRegistry::Instance().Release(transparentTexture);
+    glState.DeleteTexture(programState->cubemapTexture);
+    for (unsigned int buffer : {transparentVBO, skyboxVBO}) {
+        glDeleteBuffers(1, &buffer);
+        GpuMemory::Instance().Release(GpuMemory::Buffer, buffer);
+    }
+    glState.DeleteVertexArray(transparentVAO);
+    glState.DeleteVertexArray(skyboxVAO);
+    // the windowed path destroys the context in glfwTerminate before main's locals go, so the render
+    // objects free their GL objects here instead of in their destructors
+    for (auto &timers : sceneTimers)
+        for (GpuTimer &timer : timers)
+            timer.Release();
+    shadowTimer.Release();
+    gbuffer.Release();
+    glState.DeleteVertexArray(fullscreenVAO);
+    postProcess.Release();
+    shadowCascades.Release();
+    lightClusters.Release();
+    if (unsigned int leaks = GpuMemory::Instance().ReportLeaks(std::cout))
+        std::cout << "GPU_MEMORY:: " << leaks << " scene allocations were not released" << std::endl;
+
+    // the frames of a capture that were still in flight
+    if (trace.Capturing()) {
+        profiler.Flush();
+        trace.Write();
+    }
+
+    if (benchmarkMode) {
+        const char *renderer = (const char *) glGetString(GL_RENDERER);
+        if (benchmarkSettings.output.empty()) {
+            benchmark.WriteReport(std::cout, renderer ? renderer : "");
+        } else {
+            std::ofstream report(benchmarkSettings.output);
+            benchmark.WriteReport(report, renderer ? renderer : "");
+            if (!report)
+                std::cout << "ERROR::BENCH:: could not write " << benchmarkSettings.output << std::endl;
+        }
+        delete programState;
+        ImGui::DestroyContext();
+        return 0;
+    }
+
+    if (goldenMode) {
+        int result = golden.Report(std::cout);
+        delete programState;
+        ImGui::DestroyContext();
+        return result;
     }
 
     programState->SaveToFile("resources/program_state.txt");
@@ -606,6 +1302,12 @@ void processInput(GLFWwindow *window) {
 
 }
 
+// seconds since the first call, steady and also there without a GLFW window (--bench)
+double currentTime() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 // ---------------------------------------------------------------------------------------------
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
@@ -633,13 +1335,23 @@ void mouse_callback(GLFWwindow *window, double xpos, double ypos) {
         programState->camera.ProcessMouseMovement(xoffset, yoffset);
 }
 
+// glfw: a left click with the cursor released (ImGui mode) picks the object under it
+// ----------------------------------------------------------------------------------
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods) {
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && programState->ImGuiEnabled
+        && !ImGui::GetIO().WantCaptureMouse) {
+        glfwGetCursorPos(window, &pickX, &pickY);
+        pickRequested = true;
+    }
+}
+
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset) {
     programState->camera.ProcessMouseScroll(yoffset);
 }
 
-void DrawImGui(ProgramState *programState) {
+void DrawImGui(ProgramState *programState, const FrameStats &frameStats) {
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
@@ -664,16 +1376,247 @@ void DrawImGui(ProgramState *programState) {
         ImGui::Text("(Yaw, Pitch): (%f, %f)", c.Yaw, c.Pitch);
         ImGui::Text("Camera front: (%f, %f, %f)", c.Front.x, c.Front.y, c.Front.z);
         ImGui::Checkbox("Camera mouse update", &programState->CameraMouseMovementUpdateEnabled);
+        ImGui::Checkbox("Frustum culling", &frustumCullingOn);
+        ImGui::Text("Objects visible / culled: %u / %u (meshes culled: %u)",
+                    frameStats.culling.visible, frameStats.culling.culled, frameStats.culling.meshesCulled);
+        ImGui::Checkbox("Occlusion culling (Hi-Z)", &occlusionCullingOn);
+        unsigned int inFrustum = frameStats.culling.visible + frameStats.culling.occluded;
+        ImGui::Text("Occluded: %u (%.1f%% of draws in the frustum)", frameStats.culling.occluded,
+                    inFrustum > 0 ? 100.0f * frameStats.culling.occluded / inFrustum : 0.0f);
+        ImGui::Text("BVH: %u of %u placed objects in view", frameStats.bvhVisible, frameStats.bvhObjects);
+        ImGui::Text("Nearest object: %s (%.2f)", frameStats.nearestObject, frameStats.nearestDistance);
+        ImGui::Text("Picked object (left click): %s", frameStats.pickedObject);
         ImGui::End();
     }
 
+    DrawProfiler();
+    DrawGpuMemory();
+
+    {
+        ImGui::Begin("Render stats");
+        const RenderQueue::Stats &queue = frameStats.queue;
+        ImGui::Text("Draw packets: %u", queue.packets);
+        ImGui::Text("Program / VAO / texture / cull changes: %u / %u / %u / %u",
+                    queue.programChanges, queue.vaoChanges, queue.textureChanges, queue.cullChanges);
+        ImGui::Text("State changes avoided by sorting: %u", queue.stateChangesAvoided);
+        ImGui::Text("GL state calls issued / skipped: %u / %u", frameStats.state.issued, frameStats.state.skipped);
+        ImGui::Text("Lighting shader variants compiled: %u", frameStats.shaderVariants);
+        ImGui::Checkbox("Depth pre-pass (Z)", &depthPrePassOn);
+        ImGui::SameLine();
+        ImGui::Checkbox("Deferred shading (G)", &deferredShadingOn);
+        ImGui::Text("Pre-pass packets: %u", queue.prePassPackets);
+        ImGui::Text("Scene pass GPU, without / with pre-pass:");
+        ImGui::Text("  forward  %.3f / %.3f ms", frameStats.sceneGpuMs[0][0], frameStats.sceneGpuMs[0][1]);
+        ImGui::Text("  deferred %.3f / %.3f ms", frameStats.sceneGpuMs[1][0], frameStats.sceneGpuMs[1][1]);
+        ImGui::Checkbox("Clustered lighting", &clusteredLightingOn);
+        ImGui::SliderInt("Streetlights", &streetLightCount, 0, 1024);
+        const LightClusters::Stats &clusters = frameStats.clusters;
+        ImGui::Text("Lights visible: %u of %u, cluster build %.1f us", clusters.visibleLights, clusters.lights,
+                    clusters.buildMicroseconds);
+        ImGui::Text("Light indices: %u, occupied clusters: %u of %d, max per cluster: %u", clusters.indices,
+                    clusters.occupiedClusters, LightClusters::ClusterCount, clusters.maxPerCluster);
+        ImGui::End();
+    }
 
+    {
+        ImGui::Begin("Shadows");
+        ShadowCascades::Settings &shadows = shadowSettings;
+        ImGui::Checkbox("Cascaded shadow maps", &shadowsOn);
+        ImGui::SliderInt("Cascades", &shadows.cascades, 2, ShadowCascades::MaxCascades);
+        const int resolutions[] = {512, 1024, 2048, 4096};
+        const char *resolutionNames[] = {"512", "1024", "2048", "4096"};
+        int resolution = 0;
+        while (resolution < 3 && resolutions[resolution] < shadows.resolution)
+            resolution++;
+        if (ImGui::Combo("Resolution", &resolution, resolutionNames, 4))
+            shadows.resolution = resolutions[resolution];
+        ImGui::SliderFloat("Shadow distance", &shadows.distance, 10.0f, 100.0f);
+        ImGui::SliderFloat("Split lambda", &shadows.splitLambda, 0.0f, 1.0f);
+        if (frameStats.shadows)
+            ImGui::Text("Shadow pass GPU %.3f ms, casters drawn: %u", frameStats.shadowGpuMs, frameStats.shadowCasters);
+        else
+            ImGui::Text("Shadows off");
+        ImGui::End();
+    }
+
+
+
+    {
+        ImGui::Begin("Post-process");
+        PostProcess::Settings &post = postProcessSettings;
+        ImGui::Checkbox("HDR", &hdrOn);
+        ImGui::SameLine();
+        ImGui::Checkbox("Bloom", &post.bloom);
+        ImGui::SliderFloat("Bloom threshold", &post.threshold, 0.0f, 4.0f);
+        ImGui::SliderFloat("Bloom knee", &post.knee, 0.0f, 1.0f);
+        ImGui::SliderFloat("Bloom intensity", &post.intensity, 0.0f, 2.0f);
+        ImGui::SliderInt("Bloom levels", &post.levels, 1, std::max(frameStats.bloomLevels, 1));
+        ImGui::SliderFloat("Exposure", &post.exposure, 0.1f, 4.0f);
+        const char *tonemaps[] = {"Clamp", "Reinhard", "ACES"};
+        ImGui::Combo("Tonemap", &post.tonemap, tonemaps, 3);
+        if (frameStats.hdr) {
+            const PostProcess::Timings &timings = frameStats.post;
+            ImGui::Text("GPU: downsample %.3f ms, upsample %.3f ms, composite %.3f ms",
+                        timings.downsample, timings.upsample, timings.composite);
+        } else {
+            ImGui::Text("Rendering straight to the screen");
+        }
+        ImGui::End();
+    }
 
     ImGui::Render();
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
+// flame graph of the newest collected frame and per-zone times over the profiler history
+void DrawProfiler() {
+    static bool gpuTimeline = false;
+    static int selected = 0;
+    Profiler &profiler = Profiler::Instance();
+
+    ImGui::SetNextWindowPos(ImVec2(430, 60), ImGuiCond_FirstUseEver);
+    ImGui::SetNextWindowSize(ImVec2(560, 440), ImGuiCond_FirstUseEver);
+    ImGui::Begin("Profiler");
+    ImGui::Checkbox("Profiling", &profiler.Enabled);
+    ImGui::SameLine();
+    ImGui::Checkbox("GPU timeline", &gpuTimeline);
+    const Profiler::Frame &frame = profiler.LastFrame();
+    if (frame.zones.empty()) {
+        ImGui::Text("No frame collected yet");
+        ImGui::End();
+        return;
+    }
+    const Profiler::Zone &root = frame.zones[0];
+    bool gpu = gpuTimeline && frame.gpuValid;
+    ImGui::Text("Frame %llu: CPU %.3f ms, GPU %s%.3f ms, dropped GPU frames: %u", frame.number, root.CpuMs(),
+                frame.gpuValid ? "" : "n/a ", frame.gpuValid ? root.GpuMs() : 0.0, profiler.DroppedFrames());
+
+    // one row per nesting level, the frame spans the full width
+    ImDrawList *drawList = ImGui::GetWindowDrawList();
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    float width = std::max(ImGui::GetContentRegionAvail().x, 1.0f);
+    float rowHeight = ImGui::GetTextLineHeight() + 4.0f;
+    double span = std::max(gpu ? root.gpuEnd : root.cpuEnd, 1.0e-6);
+    int depth = 0;
+    for (const Profiler::Zone &zone : frame.zones) {
+        if (gpu && !zone.gpu)
+            continue;
+        depth = std::max(depth, zone.depth);
+        float x0 = origin.x + (float) ((gpu ? zone.gpuBegin : zone.cpuBegin) / span) * width;
+        float x1 = std::max(origin.x + (float) ((gpu ? zone.gpuEnd : zone.cpuEnd) / span) * width, x0 + 1.0f);
+        float y0 = origin.y + zone.depth * rowHeight;
+        ImVec2 min(x0, y0), max(x1, y0 + rowHeight - 1.0f);
+        // the same zone keeps its color from frame to frame
+        unsigned int hash = 2166136261u;
+        for (const char *c = zone.name; *c; c++)
+            hash = (hash ^ (unsigned char) *c) * 16777619u;
+        drawList->AddRectFilled(min, max, (ImU32) ImColor::HSV((hash % 360) / 360.0f, 0.45f, 0.75f));
+        drawList->PushClipRect(min, max, true);
+        drawList->AddText(ImVec2(x0 + 2.0f, y0 + 2.0f), IM_COL32(0, 0, 0, 255), zone.name);
+        drawList->PopClipRect();
+        if (ImGui::IsMouseHoveringRect(min, max))
+            ImGui::SetTooltip("%s\nCPU %.3f ms\nGPU %s", zone.name, zone.CpuMs(),
+                              zone.gpu && frame.gpuValid ? std::to_string(zone.GpuMs()).c_str() : "-");
+    }
+    ImGui::Dummy(ImVec2(width, (depth + 1) * rowHeight));
+
+    // average and worst time per zone over the history, a click plots the zone
+    const vector<Profiler::Series> &history = profiler.History();
+    unsigned int count = std::max(profiler.HistoryCount(), 1u);
+    if (ImGui::BeginTable("zones", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV)) {
+        ImGui::TableSetupColumn("Zone");
+        ImGui::TableSetupColumn("CPU avg");
+        ImGui::TableSetupColumn("CPU max");
+        ImGui::TableSetupColumn("GPU avg");
+        ImGui::TableSetupColumn("GPU max");
+        ImGui::TableHeadersRow();
+        for (int i = 0; i < (int) history.size(); i++) {
+            const Profiler::Series &series = history[i];
+            float cpuSum = 0.0f, cpuMax = 0.0f, gpuSum = 0.0f, gpuMax = 0.0f;
+            for (unsigned int frameIndex = 0; frameIndex < count; frameIndex++) {
+                unsigned int entry = (profiler.HistoryOffset() + Profiler::HistoryFrames - 1 - frameIndex) % Profiler::HistoryFrames;
+                cpuSum += series.cpuMs[entry];
+                cpuMax = std::max(cpuMax, series.cpuMs[entry]);
+                gpuSum += series.gpuMs[entry];
+                gpuMax = std::max(gpuMax, series.gpuMs[entry]);
+            }
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Indent(series.depth * 10.0f + 1.0f);
+            if (ImGui::Selectable(series.name.c_str(), selected == i, ImGuiSelectableFlags_SpanAllColumns))
+                selected = i;
+            ImGui::Unindent(series.depth * 10.0f + 1.0f);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", cpuSum / count);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", cpuMax);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", gpuSum / count);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", gpuMax);
+        }
+        ImGui::EndTable();
+    }
+    if (selected < (int) history.size()) {
+        const Profiler::Series &series = history[selected];
+        ImGui::Text("%s, last %u frames (ms):", series.name.c_str(), Profiler::HistoryFrames);
+        ImGui::PlotLines("CPU", series.cpuMs, Profiler::HistoryFrames, profiler.HistoryOffset(), nullptr, 0.0f, FLT_MAX, ImVec2(0, 50));
+        ImGui::PlotLines("GPU", series.gpuMs, Profiler::HistoryFrames, profiler.HistoryOffset(), nullptr, 0.0f, FLT_MAX, ImVec2(0, 50));
+    }
+    ImGui::End();
+}
+
+// totals per category and every allocation, biggest first
+void DrawGpuMemory() {
+    static bool assetsOnly = false;
+    GpuMemory &memory = GpuMemory::Instance();
+
+    ImGui::SetNextWindowPos(ImVec2(430, 510), ImGuiCond_FirstUseEver);
+    ImGui::SetNextWindowSize(ImVec2(560, 300), ImGuiCond_FirstUseEver);
+    ImGui::Begin("GPU memory");
+    ImGui::Text("%zu allocations, %.2f MB", memory.Count(), memory.TotalBytes() / (1024.0 * 1024.0));
+    for (int category = 0; category < GpuMemory::CategoryCount; category++)
+        ImGui::BulletText("%s: %.2f MB", GpuMemory::CategoryName((GpuMemory::Category) category),
+                          memory.Bytes((GpuMemory::Category) category) / (1024.0 * 1024.0));
+    ImGui::Checkbox("Scene assets only", &assetsOnly);
+
+    if (ImGui::BeginTable("allocations", 5, ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV | ImGuiTableFlags_ScrollY)) {
+        ImGui::TableSetupColumn("Owner");
+        ImGui::TableSetupColumn("MB");
+        ImGui::TableSetupColumn("Format");
+        ImGui::TableSetupColumn("Size");
+        ImGui::TableSetupColumn("File MB");
+        ImGui::TableHeadersRow();
+        for (const GpuMemory::Allocation *allocation : memory.Sorted()) {
+            if (assetsOnly && allocation->category != GpuMemory::Geometry && allocation->category != GpuMemory::AssetTexture)
+                continue;
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(allocation->owner.c_str());
+            ImGui::TableNextColumn();
+            ImGui::Text("%.2f", allocation->bytes / (1024.0 * 1024.0));
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(allocation->kind == GpuMemory::Buffer ? GpuMemory::KindName(allocation->kind)
+                                                                         : GpuMemory::FormatName(allocation->format));
+            ImGui::TableNextColumn();
+            if (allocation->kind != GpuMemory::Buffer)
+                ImGui::Text("%dx%dx%d, %d mips", allocation->width, allocation->height, allocation->layers, allocation->levels);
+            ImGui::TableNextColumn();
+            if (allocation->fileBytes > 0)
+                ImGui::Text("%.2f", allocation->fileBytes / (1024.0 * 1024.0));
+        }
+        ImGui::EndTable();
+    }
+    ImGui::End();
+}
+
 void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods) {
+    if (key == GLFW_KEY_Z && action == GLFW_PRESS)
+        depthPrePassOn = !depthPrePassOn;
+    if (key == GLFW_KEY_G && action == GLFW_PRESS)
+        deferredShadingOn = !deferredShadingOn;
+    if (key == GLFW_KEY_F9 && action == GLFW_PRESS)
+        TraceRecorder::Instance().Capture(traceFrames, traceFile);
     if (key == GLFW_KEY_F1 && action == GLFW_PRESS) {
         programState->ImGuiEnabled = !programState->ImGuiEnabled;
         if (programState->ImGuiEnabled) {
@@ -686,130 +1629,240 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
 
 }
 
+// the skybox faces are decoded in the background, the cubemap is grey until they are uploaded
 unsigned int loadCubemap(vector<std::string> faces)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    TRACE_SCOPE("loadCubemap", faces.empty() ? std::string() : faces[0]);
+    return LoadCubemap(faces);
+}
 
-    int width, height, nrComponents;
-    for (unsigned int i = 0; i < faces.size(); i++)
-    {
-        unsigned char *data = stbi_load(faces[i].c_str(), &width, &height, &nrComponents, 0);
-        if (data)
-        {
-            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-            stbi_image_free(data);
-        }
-        else
-        {
-            std::cout << "Cubemap texture failed to load at path: " << faces[i] << std::endl;
-            stbi_image_free(data);
-        }
+unsigned int loadTexture(char const * path)
+{
+    return TextureRegistry::Instance().Acquire(path);
+}
+
+// copies the lights into the LightBlock layout, the buffer skips the upload if nothing changed
+void updateLightBlock(UniformBuffer<LightBlockData> &lightBlock, const ProgramState &state) {
+    LightBlockData data = {};
+
+    data.dirLight.direction = state.dirLight.direction;
+    data.dirLight.ambient = state.dirLight.ambient;
+    data.dirLight.diffuse = state.dirLight.diffuse;
+    data.dirLight.specular = state.dirLight.specular;
+
+    for (unsigned int i = 0; i < POINT_LIGHT_COUNT; i++) {
+        PointLightStd140 &pointLight = data.pointLights[i];
+        pointLight.position = pointLightPositions[i];
+        pointLight.ambient = state.pointLight.ambient;
+        pointLight.diffuse = state.pointLight.diffuse;
+        pointLight.specular = state.pointLight.specular;
+        pointLight.constant = state.pointLight.constant;
+        pointLight.linear = state.pointLight.linear;
+        pointLight.quadratic = state.pointLight.quadratic;
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 
-    return textureID;
+    // the spotlight is a flashlight attached to the camera
+    data.spotLight.position = state.camera.Position;
+    data.spotLight.direction = state.camera.Front;
+    data.spotLight.ambient = state.spotLight.ambient;
+    data.spotLight.diffuse = state.spotLight.diffuse;
+    data.spotLight.specular = state.spotLight.specular;
+    data.spotLight.constant = state.spotLight.constant;
+    data.spotLight.linear = state.spotLight.linear;
+    data.spotLight.quadratic = state.spotLight.quadratic;
+    data.spotLight.cutOff = state.spotLight.cutOff;
+    data.spotLight.outerCutOff = state.spotLight.outerCutOff;
+
+    data.viewPosition = state.camera.Position;
+    data.pointLightOn = pointLightOn;
+    data.spotLightOn = spotLightOn;
+
+    lightBlock.Update(data);
 }
 
-unsigned int loadTexture(char const * path)
-{
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
+// the point lights of LightBlock and streetLightCount streetlights along both edges of the road,
+// for clustered lighting. The streetlights get dimmer as there are more of them, so the scene keeps
+// roughly the same brightness and their radius shrinks.
+void updateClusterLights(vector<ClusterLight> &lights, const ProgramState &state, const vector<glm::vec3> &road) {
+    lights.clear();
+
+    const PointLight &pointLight = state.pointLight;
+    float brightness = std::max(std::max(pointLight.ambient.r, pointLight.diffuse.r), pointLight.specular.r);
+    for (const glm::vec3 &position : pointLightPositions) {
+        ClusterLight light;
+        light.position = position;
+        light.ambient = pointLight.ambient;
+        light.diffuse = pointLight.diffuse;
+        light.specular = pointLight.specular;
+        light.constant = pointLight.constant;
+        light.linear = pointLight.linear;
+        light.quadratic = pointLight.quadratic;
+        light.radius = LightClusters::Range(light.constant, light.linear, light.quadratic, brightness);
+        lights.push_back(light);
+    }
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
+    if (streetLightCount <= 0 || road.size() < 2)
+        return;
+    // the road climbs along y and -z and is about 5 wide along x, its surface faces (0, 1, 1)
+    glm::vec3 up = glm::normalize(glm::vec3(0.0f, 1.0f, 1.0f));
+    float streetBrightness = std::min(1.0f, 16.0f / streetLightCount);
+    glm::vec3 color = glm::vec3(1.0f, 0.75f, 0.4f) * streetBrightness;
+    for (int i = 0; i < streetLightCount; i++) {
+        float along = (i + 0.5f) / streetLightCount * (road.size() - 1);
+        unsigned int segment = std::min((unsigned int) along, (unsigned int) road.size() - 2);
+        glm::vec3 center = glm::mix(road[segment], road[segment + 1], along - segment);
+        ClusterLight light;
+        light.position = center + glm::vec3(i % 2 == 0 ? -2.5f : 2.5f, 0.0f, 0.0f) + up * 1.5f;
+        light.diffuse = color;
+        light.specular = color;
+        light.linear = 0.7f;
+        light.quadratic = 1.8f;
+        light.radius = LightClusters::Range(light.constant, light.linear, light.quadratic, streetBrightness);
+        lights.push_back(light);
     }
+}
 
-    return textureID;
+// --cluster-bench: CPU cost of the light assignment for growing light counts. The lights are spread
+// through the view frustum with the radius shrinking as their number grows, like the streetlights.
+int runClusterBenchmark() {
+    std::mt19937 random(42);
+    const unsigned int builds = 200;
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    LightClusters clusters;
+
+    for (unsigned int count : {16u, 64u, 256u, 1024u, 4096u}) {
+        std::uniform_real_distribution<float> depth(0.5f, 60.0f), side(-1.0f, 1.0f);
+        float brightness = std::min(1.0f, 64.0f / count);
+        vector<ClusterLight> lights(count);
+        for (ClusterLight &light : lights) {
+            float z = depth(random);
+            light.position = glm::vec3(side(random) * z * 0.55f, side(random) * z * 0.41f, -z);
+            light.diffuse = glm::vec3(brightness);
+            light.linear = 0.7f;
+            light.quadratic = 1.8f;
+            light.radius = LightClusters::Range(light.constant, light.linear, light.quadratic, brightness);
+        }
+
+        double total = 0.0, slowest = 0.0;
+        for (unsigned int i = 0; i < builds; i++) {
+            clusters.Build(view, projection, 0.1f, 100.0f, lights);
+            total += clusters.LastStats().buildMicroseconds;
+            slowest = std::max(slowest, clusters.LastStats().buildMicroseconds);
+        }
+        const LightClusters::Stats &stats = clusters.LastStats();
+        std::cout << "LIGHT_CLUSTERS::BENCH " << count << " lights (radius " << lights[0].radius << "), build "
+                  << total / builds << " us avg, " << slowest << " us max, " << stats.indices << " indices, "
+                  << stats.occupiedClusters << " occupied clusters, max " << stats.maxPerCluster << " per cluster" << std::endl;
+    }
+    return 0;
 }
 
-void setShader(Shader ourShader, DirLight dirLight, PointLight pointLight, SpotLight spotLight) {
-
-    ourShader.use();
-
-    ourShader.setVec3("dirLight.direction", dirLight.direction);
-    ourShader.setVec3("dirLight.ambient", dirLight.ambient);
-    ourShader.setVec3("dirLight.diffuse", dirLight.diffuse);
-    ourShader.setVec3("dirLight.specular", dirLight.specular);
-
-    ourShader.setInt("pointLightOn", pointLightOn);
-
-    pointLight.position = glm::vec3(17.0f, 17.0f, -1.0f);
-
-    ourShader.setVec3("pointLight1.position", pointLight.position);
-    ourShader.setVec3("pointLight1.ambient", pointLight.ambient);
-    ourShader.setVec3("pointLight1.diffuse", pointLight.diffuse);
-    ourShader.setVec3("pointLight1.specular", pointLight.specular);
-    ourShader.setFloat("pointLight1.constant", pointLight.constant);
-    ourShader.setFloat("pointLight1.linear", pointLight.linear);
-    ourShader.setFloat("pointLight1.quadratic", pointLight.quadratic);
-    ourShader.setVec3("viewPosition", programState->camera.Position);
-    ourShader.setFloat("material.shininess", 32.0f);
-
-    pointLight.position = glm::vec3(18.0f, 7.0f, 10.0f);
-
-    ourShader.setVec3("pointLight2.position", pointLight.position);
-    ourShader.setVec3("pointLight2.ambient", pointLight.ambient);
-    ourShader.setVec3("pointLight2.diffuse", pointLight.diffuse);
-    ourShader.setVec3("pointLight2.specular", pointLight.specular);
-    ourShader.setFloat("pointLight2.constant", pointLight.constant);
-    ourShader.setFloat("pointLight2.linear", pointLight.linear);
-    ourShader.setFloat("pointLight2.quadratic", pointLight.quadratic);
-    ourShader.setVec3("viewPosition", programState->camera.Position);
-    ourShader.setFloat("material.shininess", 32.0f);
-
-    pointLight.position = glm::vec3(13.0f, 3.5f, 11.0f);
-
-    ourShader.setVec3("pointLight3.position", pointLight.position);
-    ourShader.setVec3("pointLight3.ambient", pointLight.ambient);
-    ourShader.setVec3("pointLight3.diffuse", pointLight.diffuse);
-    ourShader.setVec3("pointLight3.specular", pointLight.specular);
-    ourShader.setFloat("pointLight3.constant", pointLight.constant);
-    ourShader.setFloat("pointLight3.linear", pointLight.linear);
-    ourShader.setFloat("pointLight3.quadratic", pointLight.quadratic);
-    ourShader.setVec3("viewPosition", programState->camera.Position);
-    ourShader.setFloat("material.shininess", 32.0f);
-
-    ourShader.setInt("spotLightOn", spotLightOn);
-    ourShader.setVec3("spotLight.position", programState->camera.Position);
-    ourShader.setVec3("spotLight.direction", programState->camera.Front);
-    ourShader.setVec3("spotLight.ambient", spotLight.ambient);
-    ourShader.setVec3("spotLight.diffuse", spotLight.diffuse);
-    ourShader.setVec3("spotLight.specular", spotLight.specular);
-    ourShader.setFloat("spotLight.constant", spotLight.constant);
-    ourShader.setFloat("spotLight.linear", spotLight.linear);
-    ourShader.setFloat("spotLight.quadratic", spotLight.quadratic);
-    ourShader.setFloat("spotLight.cutOff", spotLight.cutOff);
-    ourShader.setFloat("spotLight.outerCutOff", spotLight.outerCutOff);
+// --bvh-bench: BVH against a flat loop over the same boxes, for growing numbers of placed objects.
+// the objects are road-sized boxes spread over a large flat area, like a long road layout.
+int runBvhBenchmark() {
+    std::mt19937 random(42);
+    const unsigned int queries = 200;
+
+    for (unsigned int count : {1000u, 10000u, 100000u}) {
+        float side = std::sqrt((float) count) * 8.0f;
+        std::uniform_real_distribution<float> position(-side, side);
+        std::uniform_real_distribution<float> size(0.5f, 4.0f);
+        vector<AABB> boxes(count);
+        for (AABB &box : boxes) {
+            glm::vec3 center(position(random), size(random), position(random));
+            glm::vec3 extents(size(random), size(random), size(random));
+            box.min = center - extents;
+            box.max = center + extents;
+        }
 
+        auto start = std::chrono::steady_clock::now();
+        BVH bvh;
+        bvh.Build(boxes);
+        double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // the same camera poses, rays and points for both sides
+        vector<Frustum> frustums;
+        vector<glm::vec3> origins, directions;
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float) SCR_WIDTH / (float) SCR_HEIGHT, 0.1f, 100.0f);
+        for (unsigned int i = 0; i < queries; i++) {
+            glm::vec3 eye(position(random), 2.0f, position(random));
+            glm::vec3 target = eye + glm::vec3(position(random), 0.0f, position(random));
+            frustums.push_back(Frustum::FromMatrix(projection * glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f))));
+            origins.push_back(eye);
+            directions.push_back(target - eye);
+        }
+
+        vector<unsigned int> visible;
+        size_t checksum = 0;
+        auto time = [&](const std::function<void(unsigned int)> &query) {
+            auto begin = std::chrono::steady_clock::now();
+            for (unsigned int i = 0; i < queries; i++)
+                query(i);
+            return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count() / queries;
+        };
+
+        double frustumBVH = time([&](unsigned int i) {
+            visible.clear();
+            bvh.QueryFrustum(frustums[i], visible);
+            checksum += visible.size();
+        });
+        double frustumFlat = time([&](unsigned int i) {
+            visible.clear();
+            for (unsigned int item = 0; item < count; item++)
+                if (frustums[i].Intersects(boxes[item]))
+                    visible.push_back(item);
+            checksum += visible.size();
+        });
+        double rayBVH = time([&](unsigned int i) {
+            checksum += bvh.Raycast(origins[i], directions[i]).item;
+        });
+        double rayFlat = time([&](unsigned int i) {
+            glm::vec3 inverse(1.0f / directions[i].x, 1.0f / directions[i].y, 1.0f / directions[i].z);
+            float best = FLT_MAX, distance;
+            int hit = -1;
+            for (unsigned int item = 0; item < count; item++)
+                if (boxes[item].IntersectRay(origins[i], inverse, best, distance) && distance < best) {
+                    best = distance;
+                    hit = (int) item;
+                }
+            checksum += hit;
+        });
+        double nearestBVH = time([&](unsigned int i) {
+            checksum += bvh.Nearest(origins[i]).item;
+        });
+        double nearestFlat = time([&](unsigned int i) {
+            float best = FLT_MAX;
+            int hit = -1;
+            for (unsigned int item = 0; item < count; item++) {
+                float distance = boxes[item].DistanceSquared(origins[i]);
+                if (distance < best) {
+                    best = distance;
+                    hit = (int) item;
+                }
+            }
+            checksum += hit;
+        });
+
+        // 1% of the objects move a little every "frame"
+        std::uniform_int_distribution<unsigned int> pick(0, count - 1);
+        double refit = time([&](unsigned int i) {
+            for (unsigned int moved = 0; moved < count / 100; moved++) {
+                unsigned int item = pick(random);
+                AABB box = bvh.ItemBounds(item);
+                glm::vec3 step(0.5f, 0.0f, 0.25f);
+                box.min = box.min + step;
+                box.max = box.max + step;
+                bvh.Update(item, box);
+            }
+        });
+
+        std::cout << "BVH::BENCH " << count << " objects, " << bvh.NodeCount() << " nodes, build " << buildMs << " ms\n"
+                  << "  frustum  bvh " << frustumBVH << " us, flat " << frustumFlat << " us\n"
+                  << "  ray      bvh " << rayBVH << " us, flat " << rayFlat << " us\n"
+                  << "  nearest  bvh " << nearestBVH << " us, flat " << nearestFlat << " us\n"
+                  << "  refit 1% " << refit << " us, SAH cost after " << queries << " refits x" << bvh.RefitQuality()
+                  << " (checksum " << checksum << ")" << std::endl;
+    }
+    return 0;
 }